@@ -25,6 +25,18 @@
 #define dy (ymax-ymin)/H
 #define norm_max (4 << mandel_shift)
 
+/* largest iteration cap, iteration counts are stored on 16 bits */
+#define MANDEL_MAX_ITER 65535
+typedef unsigned short iter_t;
+
+/* default iteration cap, compile with -DMANDEL_ITER=n to change it */
+#ifndef MANDEL_ITER
+#define MANDEL_ITER 20
+#endif
+
+int max_iter = MANDEL_ITER; // iteration cap, at most MANDEL_MAX_ITER
+int interior_tests = 1;     // cardioid/bulb test and periodicity detection
+
 
 #define ANSIRGB(R,G,B) "\033[48;2;" #R ";"  #G ";" #B "m  "
 
@@ -55,38 +67,1305 @@ const char* colormap[21] = {
    ANSIRGB( 240, 0, 0)
 };
 
+/*
+ * Scalar kernels, instantiated for several fixed-point formats by
+ * MANDEL_KERNELS(S, T, shift): T is the integer type and shift the number
+ * of fractional bits. For C in [-2,2]x[-2,2], orbit points that did not
+ * escape are in [-6,6], so products fit in T as long as 2*(shift+3) is
+ * smaller than the number of bits of T: Q10 on 32 bits (the default), Q28
+ * on 64 bits, Q60 on 128 bits (where the compiler has __int128).
+ *
+ * in_main_bulbs##S(Cr,Ci):
+ * Non-zero if C = Cr + i*Ci is in the main cardioid or in the period-2
+ * bulb, where the orbit never escapes: q*(q + x - 1/4) <= y^2/4 with
+ * q = (x - 1/4)^2 + y^2, or (x + 1)^2 + y^2 <= 1/16. Both are inside
+ * [-2,1]x[-1,1], points outside are rejected first (the products could
+ * overflow). The rounding of the fixed-point loop makes some points right
+ * inside the boundary escape, so the test keeps a margin of two units
+ * (checked against the loop on all the Q10 points near the boundary, with
+ * MANDEL_MAX_ITER iterations).
+ *
+ * mandel##S(Cr,Ci):
+ * Number of iterations left when the orbit of C = Cr + i*Ci escapes the
+ * disk of radius 2 (0 if it does not escape within max_iter iterations).
+ * With interior_tests, points in the main cardioid and period-2 bulb are
+ * rejected upfront, and the orbit is compared with a point saved at
+ * doubling intervals (Brent): in fixed point, an orbit that comes back to
+ * a previous point cycles forever, so the answer is 0 exactly.
+ *
+ * mandel_row_scalar##S(Cr,Ci,dCr,n,iter):
+ * Iteration counts of the n points Cr + X*dCr + i*Ci of a row, X=0..n-1
+ */
+#define MANDEL_KERNELS(S, T, shift)					\
+static inline int in_main_bulbs##S(T Cr, T Ci) {			\
+   const T one = (T)1 << (shift);					\
+   if(Cr < -2*one || Cr > one || Ci < -one || Ci > one) {		\
+      return 0;								\
+   }									\
+   T x  = Cr - (one >> 2);						\
+   T y2 = (Ci * Ci) >> (shift);						\
+   T q  = ((x * x) >> (shift)) + y2;					\
+   if(((q * (q + x)) >> (shift)) < (y2 >> 2) - 2) {			\
+      return 1;								\
+   }									\
+   T x1 = Cr + one;							\
+   return ((x1 * x1) >> (shift)) + y2 < (one >> 4) - 2;			\
+}									\
+									\
+static inline int mandel##S(T Cr, T Ci) {				\
+   if(interior_tests && in_main_bulbs##S(Cr, Ci)) {			\
+      return 0;								\
+   }									\
+   const T norm = (T)4 << (shift);					\
+   T Zr = Cr;								\
+   T Zi = Ci;								\
+   T Sr = Cr;								\
+   T Si = Ci;								\
+   int period = 1;							\
+   int k = 0;								\
+   int iter = max_iter;							\
+   while(iter > 0) {							\
+      T Zrr = (Zr * Zr) >> (shift);					\
+      T Zii = (Zi * Zi) >> (shift);					\
+      T Zri = (Zr * Zi) >> ((shift) - 1);				\
+      Zr = Zrr - Zii + Cr;						\
+      Zi = Zri + Ci;							\
+      if(Zrr + Zii > norm) {						\
+	 break;								\
+      }									\
+      --iter;								\
+      if(interior_tests) {						\
+	 if(Zr == Sr && Zi == Si) {					\
+	    return 0;							\
+	 }								\
+	 if(++k == period) {						\
+	    Sr = Zr;							\
+	    Si = Zi;							\
+	    k = 0;							\
+	    period *= 2;						\
+	 }								\
+      }									\
+   }									\
+   return iter;								\
+}									\
+									\
+void mandel_row_scalar##S(T Cr, T Ci, T dCr, int n, iter_t* iter) {	\
+   for(int X=0; X<n; ++X) {						\
+      iter[X] = mandel##S(Cr, Ci);					\
+      Cr += dCr;							\
+   }									\
+}
+
+MANDEL_KERNELS(, int, mandel_shift)
+
+/* the wider formats are only used by the zoom (and by the bench) */
+#if defined(MANDEL_ZOOM) || defined(MANDEL_BENCH)
+MANDEL_KERNELS(_q28, long long, 28)
+#ifdef __SIZEOF_INT128__
+MANDEL_KERNELS(_q60, __int128, 60)
+#endif
+#endif
+
+/*
+ * SIMD version: 8 points per vector with AVX2 (4 with SSE4.1, that has
+ * pmulld), using GCC vector extensions. All the lanes run the same
+ * iterations as the scalar loop with 32-bit wrapping products and
+ * arithmetic shifts, so that the result is bit-exact. Escaped lanes are
+ * masked out of the count, and the loop exits when all lanes escaped.
+ * Enabled on x86 when compiling with -mavx2 or -msse4.1 (or -march=native).
+ */
+#if defined(__GNUC__) && (defined(__AVX2__) || defined(__SSE4_1__))
+#define MANDEL_SIMD
+#endif
+
+#ifdef MANDEL_SIMD
+
+#include <immintrin.h>
+
+/* 8 lanes fill an AVX2 register, 4 lanes an SSE one */
+#ifdef __AVX2__
+#define MANDEL_LANES 8
+#define vany(mask) _mm256_movemask_epi8((__m256i)(mask))
+#else
+#define MANDEL_LANES 4
+#define vany(mask) _mm_movemask_epi8((__m128i)(mask))
+#endif
+
+typedef int vint __attribute__((vector_size(4 * MANDEL_LANES)));
+
+/* lane-wise in_main_bulbs(), -1 in the lanes inside */
+static inline vint vin_main_bulbs(vint Cr, vint Ci) {
+   vint x  = Cr - (mandel_mul >> 2);
+   vint y2 = (Ci * Ci) >> mandel_shift;
+   vint q  = ((x * x) >> mandel_shift) + y2;
+   vint x1 = Cr + mandel_mul;
+   return (((q * (q + x)) >> mandel_shift) < (y2 >> 2) - 2) |
+	  (((x1 * x1) >> mandel_shift) + y2 < (mandel_mul >> 4) - 2);
+}
+
+void mandel_row(int Cr, int Ci, int dCr, int n, iter_t* iter) {
+   const vint zero = { 0 };
+   vint lane;
+   for(int l = 0; l < MANDEL_LANES; ++l) {
+      lane[l] = l;
+   }
+   int X = 0;
+   for(; X + MANDEL_LANES <= n; X += MANDEL_LANES) {
+      vint vCr = Cr + dCr * lane;
+      vint vCi = zero + Ci;
+      vint Zr = vCr;
+      vint Zi = vCi;
+      vint Sr = vCr;
+      vint Si = vCi;
+      vint viter = zero + max_iter;
+      vint active = zero - 1; // all lanes
+      int period = 1;
+      int k = 0;
+      if(interior_tests) {
+	 vint inside = vin_main_bulbs(vCr, vCi);
+	 viter &= ~inside;
+	 active &= ~inside;
+      }
+      for(int i = 0; i < max_iter && vany(active); ++i) {
+	 vint Zrr = (Zr * Zr) >> mandel_shift;
+	 vint Zii = (Zi * Zi) >> mandel_shift;
+	 vint Zri = (Zr * Zi) >> (mandel_shift - 1);
+	 Zr = Zrr - Zii + vCr;
+	 Zi = Zri + vCi;
+	 active &= (Zrr + Zii <= norm_max);
+	 viter += active; // -1 in the lanes that did not escape
+	 if(interior_tests) {
+	    vint cycle = active & (Zr == Sr) & (Zi == Si);
+	    viter &= ~cycle;
+	    active &= ~cycle;
+	    if(++k == period) {
+	       Sr = Zr;
+	       Si = Zi;
+	       k = 0;
+	       period *= 2;
+	    }
+	 }
+      }
+      for(int l = 0; l < MANDEL_LANES; ++l) {
+	 iter[X+l] = viter[l];
+      }
+      Cr += MANDEL_LANES * dCr;
+   }
+   mandel_row_scalar(Cr, Ci, dCr, n - X, iter + X);
+}
+
+#else
+
+void mandel_row(int Cr, int Ci, int dCr, int n, iter_t* iter) {
+   mandel_row_scalar(Cr, Ci, dCr, n, iter);
+}
+
+#endif
+
+/*
+ * Iteration counts of the w x h points (x0 + X*d) + i*(y0 + Y*d), with
+ * mandel_row(), stored row by row in iter.
+ */
+void mandel_frame(int x0, int y0, int d, int w, int h, iter_t* iter) {
+   for(int Y=0; Y<h; ++Y) {
+      mandel_row(x0, y0 + Y*d, d, w, iter + Y*w);
+   }
+}
+
+/*
+ * Progressive rendering, for slow CPUs (compile with -DMANDEL_PROGRESSIVE
+ * for the demo to use it): mandel_frame_pass() is called with
+ * step = MANDEL_PROG_STEP, then step/2, ... down to 1. Each pass computes
+ * the pixels at multiples of step that the previous pass did not compute,
+ * then fills each step x step block with the value of its top-left pixel,
+ * so that the frame can be displayed after each pass. Returns the number
+ * of pixels computed, the w x h pixels are computed exactly once over the
+ * passes, and the result is the same as mandel_frame().
+ */
+#define MANDEL_PROG_STEP 8
+
+int mandel_frame_pass(
+   int x0, int y0, int d, int w, int h, iter_t* iter, int step
+) {
+   int computed = 0;
+   for(int Y=0; Y<h; Y+=step) {
+      // in the rows of the previous pass, only the odd multiples of step
+      int X0 = 0;
+      int dX = step;
+      if(step < MANDEL_PROG_STEP && Y % (2*step) == 0) {
+	 X0 = step;
+	 dX = 2*step;
+      }
+      for(int X=X0; X<w; X+=dX) {
+	 iter[Y*w + X] = mandel(x0 + X*d, y0 + Y*d);
+	 ++computed;
+      }
+   }
+   if(step > 1) {
+      for(int Y=0; Y<h; ++Y) {
+	 const iter_t* src = iter + (Y - Y%step)*w;
+	 iter_t* dst = iter + Y*w;
+	 for(int X=0; X<w; X+=step) {
+	    iter_t c = src[X];
+	    for(int k=0; k<step && X+k<w; ++k) {
+	       dst[X+k] = c;
+	    }
+	 }
+      }
+   }
+   return computed;
+}
+
+/*
+ * Automatic precision: the view is given in the widest fixed-point format,
+ * mandel_coord_t (Q60 on 128 bits, or Q28 on 64 bits where the compiler
+ * has no __int128), and each frame is computed with the cheapest format
+ * in which the pixel spacing is still at least 2^MANDEL_GUARD_BITS units.
+ */
+#if defined(MANDEL_ZOOM) || defined(MANDEL_BENCH)
+
+#ifdef __SIZEOF_INT128__
+typedef __int128 mandel_coord_t;
+#define MANDEL_COORD_SHIFT 60
+#else
+typedef long long mandel_coord_t;
+#define MANDEL_COORD_SHIFT 28
+#endif
+
+#define MANDEL_GUARD_BITS 4
+
+/*
+ * Number of fractional bits of the format used for a pixel spacing d
+ * (in mandel_coord_t), -1 if even the widest one is not precise enough.
+ */
+int mandel_format(mandel_coord_t d) {
+   const mandel_coord_t one = 1;
+   if(d >= one << (MANDEL_COORD_SHIFT - mandel_shift + MANDEL_GUARD_BITS)) {
+      return mandel_shift;
+   }
+   if(d >= one << (MANDEL_COORD_SHIFT - 28 + MANDEL_GUARD_BITS)) {
+      return 28;
+   }
+#ifdef __SIZEOF_INT128__
+   if(d >= one << MANDEL_GUARD_BITS) {
+      return 60;
+   }
+#endif
+   return -1;
+}
+
+/*
+ * mandel() and mandel_row() in the format with shift fractional bits
+ * (mandel_shift, 28 or 60), the coordinates being already in this format.
+ */
+static inline int mandel_point(int shift, mandel_coord_t Cr, mandel_coord_t Ci) {
+   if(shift == mandel_shift) {
+      return mandel((int)Cr, (int)Ci);
+   }
+#ifdef __SIZEOF_INT128__
+   if(shift == 60) {
+      return mandel_q60(Cr, Ci);
+   }
+#endif
+   return mandel_q28((long long)Cr, (long long)Ci);
+}
+
+static void mandel_row_fixed(
+   int shift, mandel_coord_t Cr, mandel_coord_t Ci, mandel_coord_t dCr,
+   int n, iter_t* iter
+) {
+   if(shift == mandel_shift) {
+      mandel_row((int)Cr, (int)Ci, (int)dCr, n, iter);
+      return;
+   }
+#ifdef __SIZEOF_INT128__
+   if(shift == 60) {
+      mandel_row_scalar_q60(Cr, Ci, dCr, n, iter);
+      return;
+   }
+#endif
+   mandel_row_scalar_q28((long long)Cr, (long long)Ci, (long long)dCr, n, iter);
+}
+
+/*
+ * Row Y of a view given in mandel_coord_t, computed in the format with
+ * shift fractional bits: pixel X is at ((x0 + X*d) >> s, (y0 + Y*d) >> s),
+ * s = MANDEL_COORD_SHIFT - shift. The coordinates are computed in
+ * mandel_coord_t, else the truncation of d would add up along the row
+ * (and scale the image). When d is a multiple of 2^s (power-of-two
+ * spacings), stepping by d >> s gives the same coordinates, and the row
+ * kernels are used.
+ */
+static void mandel_row_view(
+   int shift, mandel_coord_t x0, mandel_coord_t y0, mandel_coord_t d,
+   int Y, int w, iter_t* iter
+) {
+   int s = MANDEL_COORD_SHIFT - shift;
+   mandel_coord_t Ci = (y0 + Y*d) >> s;
+   if((d & ((((mandel_coord_t)1) << s) - 1)) == 0) {
+      mandel_row_fixed(shift, x0 >> s, Ci, d >> s, w, iter);
+      return;
+   }
+   for(int X=0; X<w; ++X) {
+      iter[X] = mandel_point(shift, (x0 + X*d) >> s, Ci);
+   }
+}
+
+/*
+ * mandel_frame() with the view in mandel_coord_t, computed in the format
+ * with shift fractional bits (mandel_shift, 28 or 60).
+ */
+void mandel_frame_fixed(
+   int shift, mandel_coord_t x0, mandel_coord_t y0, mandel_coord_t d,
+   int w, int h, iter_t* iter
+) {
+   for(int Y=0; Y<h; ++Y) {
+      mandel_row_view(shift, x0, y0, d, Y, w, iter + Y*w);
+   }
+}
+
+/* same as mandel_frame_fixed(), with the format chosen by mandel_format() */
+int mandel_frame_auto(
+   mandel_coord_t x0, mandel_coord_t y0, mandel_coord_t d,
+   int w, int h, iter_t* iter
+) {
+   int shift = mandel_format(d);
+   if(shift < 0) {
+      shift = MANDEL_COORD_SHIFT;
+   }
+   mandel_frame_fixed(shift, x0, y0, d, w, h, iter);
+   return shift;
+}
+
+#endif
+
+/*
+ * Threads (Linux and macOS): the rows through the set are much slower than
+ * the rows outside, so the rows are not split statically between the
+ * threads, each thread takes the next MANDEL_MT_ROWS rows from a shared
+ * atomic counter until the frame is done.
+ */
+#if defined(__linux__) || defined(__APPLE__)
+#define MANDEL_THREADS
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#define MANDEL_MAX_THREADS 64
+#else
+#define MANDEL_MAX_THREADS 1
+#endif
+
+#define MANDEL_MT_ROWS 1
+
+typedef struct {
+   int x0, y0, d, w, h;
+   iter_t* iter;
+#ifdef MANDEL_THREADS
+   atomic_int next_row;
+#else
+   int next_row;
+#endif
+} MandelJob;
+
+typedef struct {
+   MandelJob* job;
+#ifdef MANDEL_THREADS
+   double busy; // seconds spent computing rows
+   pthread_t thread;
+   int started; // 0 if pthread_create() failed
+#endif
+} MandelWorker;
+
+#ifdef MANDEL_THREADS
+static double mandel_now() {
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return (double)t.tv_sec + 1e-9 * (double)t.tv_nsec;
+}
+#endif
+
+static void* mandel_worker(void* arg) {
+   MandelWorker* worker = (MandelWorker*)arg;
+   MandelJob* J = worker->job;
+#ifdef MANDEL_THREADS
+   double start = mandel_now();
+#endif
+   for(;;) {
+#ifdef MANDEL_THREADS
+      int Y0 = atomic_fetch_add(&J->next_row, MANDEL_MT_ROWS);
+#else
+      int Y0 = J->next_row;
+      J->next_row += MANDEL_MT_ROWS;
+#endif
+      if(Y0 >= J->h) {
+	 break;
+      }
+      for(int Y=Y0; Y<Y0+MANDEL_MT_ROWS && Y<J->h; ++Y) {
+	 mandel_row(J->x0, J->y0 + Y*J->d, J->d, J->w, J->iter + Y*J->w);
+      }
+   }
+#ifdef MANDEL_THREADS
+   worker->busy = mandel_now() - start;
+#endif
+   return NULL;
+}
+
+/*
+ * Same arguments as mandel_frame(), computed by nb_threads threads (the
+ * calling one is one of them). If busy is not NULL, busy[t] is the time
+ * spent by thread t, in seconds (threaded builds only: without threads,
+ * nothing here uses floating point, for FPU-less targets).
+ */
+void mandel_frame_mt(
+   int x0, int y0, int d, int w, int h, iter_t* iter,
+   int nb_threads, double* busy
+) {
+   MandelJob job = { x0, y0, d, w, h, iter, 0 };
+   MandelWorker workers[MANDEL_MAX_THREADS];
+   if(nb_threads < 1) {
+      nb_threads = 1;
+   }
+   if(nb_threads > MANDEL_MAX_THREADS) {
+      nb_threads = MANDEL_MAX_THREADS;
+   }
+   for(int t=0; t<nb_threads; ++t) {
+      workers[t].job = &job;
+   }
+#ifdef MANDEL_THREADS
+   for(int t=0; t<nb_threads; ++t) {
+      workers[t].busy = 0.0;
+   }
+   // if a thread cannot be created, its share goes to the others (the
+   // rows are taken from the counter), the calling thread at least
+   for(int t=1; t<nb_threads; ++t) {
+      workers[t].started = pthread_create(
+	 &workers[t].thread, NULL, mandel_worker, &workers[t]
+      ) == 0;
+   }
+#endif
+   mandel_worker(&workers[0]);
+#ifdef MANDEL_THREADS
+   for(int t=1; t<nb_threads; ++t) {
+      if(workers[t].started) {
+	 pthread_join(workers[t].thread, NULL);
+      }
+   }
+   if(busy != NULL) {
+      for(int t=0; t<nb_threads; ++t) {
+	 busy[t] = workers[t].busy;
+      }
+   }
+#else
+   (void)busy;
+#endif
+}
+
+/* number of threads used by the demo: one per CPU */
+int mandel_nb_threads() {
+#ifdef MANDEL_THREADS
+   return (int)sysconf(_SC_NPROCESSORS_ONLN);
+#else
+   return 1;
+#endif
+}
+
+/*
+ * Zoom reuse: the pixels of the previous frame are kept, keyed by their
+ * coordinates in mandel_coord_t (and by the format of the frame). When the view is
+ * zoomed by 2 and the grids are aligned (power-of-two pixel spacing and
+ * fixed center), one pixel out of four of the new frame is already known,
+ * in one row out of two. Since a pixel only depends on its coordinates,
+ * the result is the same as mandel_frame_auto().
+ */
+#if defined(MANDEL_ZOOM) || defined(MANDEL_BENCH)
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+   int shift;                // format of the cached frame, -1 if empty
+   int max_iter;             // iteration cap of the cached frame
+   mandel_coord_t x0, y0, d; // in mandel_coord_t
+   int w, h;
+   int size;                 // capacity of iter
+   iter_t* iter;
+} MandelCache;
+
+void mandel_cache_init(MandelCache* cache) {
+   memset(cache, 0, sizeof(MandelCache));
+   cache->shift = -1;
+}
+
+void mandel_cache_free(MandelCache* cache) {
+   free(cache->iter);
+   mandel_cache_init(cache);
+}
+
+/* index of p on the grid x0 + k*d, k=0..n-1, -1 if not on it */
+static int mandel_cache_index(
+   mandel_coord_t p, mandel_coord_t x0, mandel_coord_t d, int n
+) {
+   mandel_coord_t k = p - x0;
+   if(k < 0 || k % d != 0 || k / d >= n) {
+      return -1;
+   }
+   return (int)(k / d);
+}
+
+/*
+ * mandel_frame_auto() that takes the pixels it can from the cache, then
+ * stores the new frame in it. Returns the number of pixels computed.
+ */
+int mandel_frame_cached(
+   MandelCache* cache, mandel_coord_t x0, mandel_coord_t y0,
+   mandel_coord_t d, int w, int h, iter_t* iter
+) {
+   int shift = mandel_format(d);
+   if(shift < 0) {
+      shift = MANDEL_COORD_SHIFT;
+   }
+   int s = MANDEL_COORD_SHIFT - shift;
+   int reuse = (cache->shift == shift && cache->max_iter == max_iter);
+   int computed = 0;
+   int* cache_X = malloc(sizeof(int) * w);
+   for(int X=0; X<w; ++X) {
+      cache_X[X] = reuse ?
+	 mandel_cache_index(x0 + X*d, cache->x0, cache->d, cache->w) : -1;
+   }
+   for(int Y=0; Y<h; ++Y) {
+      int cache_Y = reuse ?
+	 mandel_cache_index(y0 + Y*d, cache->y0, cache->d, cache->h) : -1;
+      iter_t* row = iter + Y*w;
+      if(cache_Y < 0) {
+	 mandel_row_view(shift, x0, y0, d, Y, w, row);
+	 computed += w;
+	 continue;
+      }
+      const iter_t* cache_row = cache->iter + cache_Y * cache->w;
+      mandel_coord_t Ci = (y0 + Y*d) >> s;
+      for(int X=0; X<w; ++X) {
+	 if(cache_X[X] >= 0) {
+	    row[X] = cache_row[cache_X[X]];
+	 } else {
+	    row[X] = mandel_point(shift, (x0 + X*d) >> s, Ci);
+	    ++computed;
+	 }
+      }
+   }
+   free(cache_X);
+   if(cache->size < w*h) {
+      free(cache->iter);
+      cache->iter = malloc(sizeof(iter_t) * w * h);
+      cache->size = w*h;
+   }
+   memcpy(cache->iter, iter, sizeof(iter_t) * w * h);
+   cache->shift = shift;
+   cache->max_iter = max_iter;
+   cache->x0 = x0;
+   cache->y0 = y0;
+   cache->d  = d;
+   cache->w  = w;
+   cache->h  = h;
+   return computed;
+}
+
+#endif
+
+/*
+ * Deep zoom, compile with -DMANDEL_ZOOM: the frames are computed with
+ * mandel_frame_auto() as long as a fixed-point format is precise enough,
+ * then the zoom animation switches to perturbation. The
+ * orbit of the center of the view (the reference) is computed once per
+ * frame in multi-word fixed point, and stored as doubles. The orbit of
+ * each pixel is iterated as a small double-precision delta from it:
+ *   z[n] = Z[n] + e[n],  e[n+1] = 2 Z[n] e[n] + e[n]^2 + c - C
+ * Glitches (loss of precision when z[n] comes close to 0, or reference
+ * orbit that escapes first) are handled by rebasing: the delta becomes
+ * z[n] itself, relative to Z[0] = 0, and the reference restarts.
+ */
+#if defined(MANDEL_ZOOM) || defined(MANDEL_BENCH)
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Multi-word fixed point: MP_WORDS 32-bit words, little endian, two's
+ * complement. The last word is the (signed) integer part, the others
+ * are 32*(MP_WORDS-1) bits of fraction.
+ */
+#define MP_WORDS 6
+typedef struct { unsigned int w[MP_WORDS]; } mp_t;
+
+static inline int mp_negative(const mp_t* a) {
+   return (int)a->w[MP_WORDS-1] < 0;
+}
+
+static void mp_neg(mp_t* a) {
+   unsigned long long carry = 1;
+   for(int i=0; i<MP_WORDS; ++i) {
+      carry += (unsigned int)~a->w[i];
+      a->w[i] = (unsigned int)carry;
+      carry >>= 32;
+   }
+}
+
+static void mp_add(mp_t* r, const mp_t* a, const mp_t* b) {
+   unsigned long long carry = 0;
+   for(int i=0; i<MP_WORDS; ++i) {
+      carry += (unsigned long long)a->w[i] + b->w[i];
+      r->w[i] = (unsigned int)carry;
+      carry >>= 32;
+   }
+}
+
+static void mp_sub(mp_t* r, const mp_t* a, const mp_t* b) {
+   mp_t nb = *b;
+   mp_neg(&nb);
+   mp_add(r, a, &nb);
+}
+
+/* product, truncated towards zero */
+static void mp_mul(mp_t* r, const mp_t* a, const mp_t* b) {
+   mp_t A = *a, B = *b;
+   unsigned int p[2*MP_WORDS] = { 0 };
+   int neg = 0;
+   if(mp_negative(&A)) {
+      mp_neg(&A);
+      neg = !neg;
+   }
+   if(mp_negative(&B)) {
+      mp_neg(&B);
+      neg = !neg;
+   }
+   for(int i=0; i<MP_WORDS; ++i) {
+      unsigned long long carry = 0;
+      for(int j=0; j<MP_WORDS; ++j) {
+	 carry += (unsigned long long)A.w[i] * B.w[j] + p[i+j];
+	 p[i+j] = (unsigned int)carry;
+	 carry >>= 32;
+      }
+      p[i+MP_WORDS] = (unsigned int)carry;
+   }
+   for(int i=0; i<MP_WORDS; ++i) {
+      r->w[i] = p[i + MP_WORDS-1];
+   }
+   if(neg) {
+      mp_neg(r);
+   }
+}
+
+static double mp_to_double(const mp_t* a) {
+   mp_t A = *a;
+   double result = 0.0;
+   int neg = mp_negative(&A);
+   if(neg) {
+      mp_neg(&A);
+   }
+   for(int i=0; i<MP_WORDS; ++i) {
+      result = result * (1.0 / 4294967296.0) + (double)A.w[i];
+   }
+   return neg ? -result : result;
+}
+
+/* truncation to mandel_coord_t */
+static mandel_coord_t mp_to_coord(const mp_t* a) {
+   mandel_coord_t r = (int)a->w[MP_WORDS-1];
+   int bits = MANDEL_COORD_SHIFT;
+   for(int i=MP_WORDS-2; bits > 0; --i) {
+      int b = bits < 32 ? bits : 32;
+      r = r * ((mandel_coord_t)1 << b) + (a->w[i] >> (32 - b));
+      bits -= b;
+   }
+   return r;
+}
+
+/* parses [-]digits[.digits] */
+static void mp_from_string(mp_t* r, const char* s) {
+   int neg = (*s == '-');
+   const char* frac;
+   const char* end;
+   unsigned int ipart = 0;
+   s += neg;
+   for(; *s >= '0' && *s <= '9'; ++s) {
+      ipart = 10*ipart + (*s - '0');
+   }
+   memset(r, 0, sizeof(mp_t));
+   frac = (*s == '.') ? s+1 : s;
+   for(end = frac; *end >= '0' && *end <= '9'; ++end);
+   // fraction from the last digit to the first one: r = (r + digit) / 10
+   while(end > frac) {
+      unsigned long long rem = *--end - '0';
+      for(int i=MP_WORDS-2; i>=0; --i) {
+	 rem = (rem << 32) | r->w[i];
+	 r->w[i] = (unsigned int)(rem / 10);
+	 rem %= 10;
+      }
+      r->w[MP_WORDS-1] = 0;
+   }
+   r->w[MP_WORDS-1] = ipart;
+   if(neg) {
+      mp_neg(r);
+   }
+}
+
+/*
+ * Reference orbit Z[0] = 0, Z[n+1] = Z[n]^2 + C, n < max_iter, stored in
+ * Zr[], Zi[] (max_iter + 1 entries). Returns the index of the last point
+ * before the orbit escapes (max_iter if it does not).
+ */
+int reference_orbit(const mp_t* Cr, const mp_t* Ci, double* Zr, double* Zi) {
+   mp_t zr, zi, zrr, zii, zri;
+   memset(&zr, 0, sizeof(mp_t));
+   memset(&zi, 0, sizeof(mp_t));
+   Zr[0] = 0.0;
+   Zi[0] = 0.0;
+   for(int n=0; n<max_iter; ++n) {
+      mp_mul(&zrr, &zr, &zr);
+      mp_mul(&zii, &zi, &zi);
+      mp_mul(&zri, &zr, &zi);
+      mp_sub(&zr, &zrr, &zii);
+      mp_add(&zr, &zr, Cr);
+      mp_add(&zi, &zri, &zri);
+      mp_add(&zi, &zi, Ci);
+      Zr[n+1] = mp_to_double(&zr);
+      Zi[n+1] = mp_to_double(&zi);
+      if(Zr[n+1]*Zr[n+1] + Zi[n+1]*Zi[n+1] > 4.0) {
+	 return n;
+      }
+   }
+   return max_iter;
+}
+
+/*
+ * Number of iterations left when the orbit of C + dCr + i*dCi escapes
+ * (same convention as mandel()), with the reference orbit of C of length
+ * ref_len.
+ */
+int mandel_perturb(
+   const double* Zr, const double* Zi, int ref_len, double dCr, double dCi
+) {
+   double er = 0.0, ei = 0.0;
+   int n = 0;
+   int iter = max_iter;
+   while(iter > 0) {
+      // e = 2 Z e + e^2 + dC
+      double tr = 2.0*(Zr[n]*er - Zi[n]*ei) + er*er - ei*ei + dCr;
+      double ti = 2.0*(Zr[n]*ei + Zi[n]*er) + 2.0*er*ei + dCi;
+      er = tr;
+      ei = ti;
+      ++n;
+      double zr = Zr[n] + er;
+      double zi = Zi[n] + ei;
+      double z2 = zr*zr + zi*zi;
+      if(z2 > 4.0) {
+	 break;
+      }
+      --iter;
+      // rebase when z is closer to 0 than to the reference
+      if(z2 < er*er + ei*ei || n >= ref_len) {
+	 er = zr;
+	 ei = zi;
+	 n = 0;
+      }
+   }
+   return iter;
+}
+
+/*
+ * Iteration counts of the w x h points (Cr + (X - w/2)*d) + i*(Ci + (Y-h/2)*d)
+ * stored row by row in iter.
+ */
+void mandel_frame_perturb(
+   const mp_t* Cr, const mp_t* Ci, double d, int w, int h, iter_t* iter
+) {
+   double* Zr = malloc(sizeof(double) * (max_iter + 1));
+   double* Zi = malloc(sizeof(double) * (max_iter + 1));
+   int ref_len = reference_orbit(Cr, Ci, Zr, Zi);
+   for(int Y=0; Y<h; ++Y) {
+      for(int X=0; X<w; ++X) {
+	 iter[Y*w+X] = mandel_perturb(
+	    Zr, Zi, ref_len, (X - w/2) * d, (Y - h/2) * d
+	 );
+      }
+   }
+   free(Zr);
+   free(Zi);
+}
+
+/* A point in the seahorse valley, from where the zoom animation dives */
+const char* zoom_center[2] = {
+   "-0.743643887037158704752191506114774",
+   "0.131825904205311970493132056385139"
+};
+
+/*
+ * Zoom animation: starts with a pixel spacing of 2^-ZOOM_START (a power of
+ * two, so that mandel_frame_cached() can reuse pixels), and zooms 2x per
+ * frame ZOOM_FRAMES times.
+ */
+#define ZOOM_START 4
+#define ZOOM_FRAMES 100
+
+/*
+ * Iteration cap at zoom 2^depth: the orbits near the center take longer
+ * to escape as the zoom goes deeper (at least 3000 iterations from 2^48,
+ * 8000 from 2^56, 27000 at 2^100). The cap is raised by ZOOM_ITER_STEP
+ * every ZOOM_ITER_FRAMES frames only, since the cache cannot reuse pixels
+ * computed with another cap.
+ */
+#define ZOOM_ITER 4000
+#define ZOOM_ITER_STEP 3500
+#define ZOOM_ITER_FRAMES 8
+
+static inline int zoom_iter(int depth) {
+   int cap = ZOOM_ITER + ZOOM_ITER_STEP * (depth / ZOOM_ITER_FRAMES);
+   return cap < MANDEL_MAX_ITER ? cap : MANDEL_MAX_ITER;
+}
+
+#endif
+
+/*
+ * Escape iteration counts, computed on the first frame: only the palette
+ * rotates from a frame to the next one.
+ */
+iter_t iters[H][W];
+
+/* Displays a row, the color of a pixel is (iteration count + offset) % 21 */
+void show_row(const iter_t* iter, int w, int offset) {
+   int last_color = -1;
+   for(int X=0; X<w; ++X) {
+      int color = (iter[X]+offset)%21;
+      printf("%s", color == last_color ? "  " : colormap[color]);
+      last_color = color;
+   }
+   printf("\033[49m\n");
+}
+
+#ifdef MANDEL_ZOOM
+int zoom() {
+   mp_t Cr, Ci;
+   mp_from_string(&Cr, zoom_center[0]);
+   mp_from_string(&Ci, zoom_center[1]);
+   MandelCache cache;
+   mandel_cache_init(&cache);
+   for(;;) {
+      double d = 1.0 / (double)(1 << ZOOM_START);
+      mandel_coord_t dc = (mandel_coord_t)1 << (MANDEL_COORD_SHIFT - ZOOM_START);
+      for(int frame=0; frame<=ZOOM_FRAMES; ++frame) {
+	 max_iter = zoom_iter(frame);
+	 int shift = mandel_format(dc);
+	 if(shift >= 0) {
+	    mandel_frame_cached(
+	       &cache, mp_to_coord(&Cr) - (W/2)*dc, mp_to_coord(&Ci) - (H/2)*dc,
+	       dc, W, H, iters[0]
+	    );
+	 } else {
+	    mandel_frame_perturb(&Cr, &Ci, d, W, H, iters[0]);
+	 }
+	 printf("\033[H");
+	 for(int Y=0; Y<H; ++Y) {
+	    show_row(iters[Y], W, 0);
+	 }
+	 if(shift >= 0) {
+	    printf("zoom: 2^%d  Q%d  max_iter %d      \n", frame, shift, max_iter);
+	 } else {
+	    printf("zoom: 2^%d  perturbation  max_iter %d\n", frame, max_iter);
+	 }
+	 d *= 0.5;
+	 dc >>= 1;
+#ifdef __linux__
+	 usleep(100000);
+#endif
+      }
+   }
+   return 0;
+}
+#endif
+
+/*
+ * Benchmark mode, compile with -DMANDEL_BENCH: computes the [-2,2]x[-2,2]
+ * square at several resolutions and iteration caps, and reports the number
+ * of pixels per second of:
+ *  - mandel_row_scalar() and mandel_row(), that must give the same counts
+ *  - mandel_frame() without and with the interior tests, that must give
+ *    the same counts
+ *  - mandel_frame_perturb() at several zoom depths, with the iteration cap
+ *    of the zoom animation (the frame must not be flat), compared with the
+ *    orbits computed in multi-word fixed point (except for chaotic pixels)
+ *  - mandel_frame_mt() at the demo size and at 1920x1080, with the time
+ *    each thread stays busy, that must give the same counts as
+ *    mandel_frame()
+ *  - mandel_frame_auto() at several zoom depths, compared with the widest
+ *    fixed-point format (the view is truncated to the chosen format, the
+ *    iteration counts near the boundary are not expected to be the same),
+ *    and with pixel spacings that are not exact in the chosen format, where
+ *    each pixel must be the same as a 1x1 frame at its coordinates
+ *  - mandel_frame_cached() on a zoom sequence, that must give the same
+ *    counts as mandel_frame_auto()
+ *  - mandel_frame_pass(), with the time to the first pass, that must give
+ *    the same counts as mandel_frame() and compute each pixel once
+ */
+#ifdef MANDEL_BENCH
+
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_SIZES 4
+#define BENCH_MP_STEP 3 // multi-word orbits are slow, only 1 pixel out of 3x3
+#define BENCH_MP_CHAOS 1e-9 // in pixels, see the perturbation section
+const int bench_sizes[BENCH_SIZES] = { 46, 256, 1024, 2048 };
+
+/* pixels per second of a row kernel on the size x size square */
+double bench_kernel(
+   void (*row)(int, int, int, int, iter_t*),
+   int size, iter_t* iter
+) {
+   int d = (xmax-xmin)/size;
+   int nb_frames = 0;
+   clock_t start = clock(), t;
+   do {
+      int Ci = ymin;
+      for(int Y=0; Y<size; ++Y) {
+	 row(xmin, Ci, d, size, iter + Y*size);
+	 Ci += d;
+      }
+      ++nb_frames;
+      t = clock() - start;
+   } while(t < CLOCKS_PER_SEC / 4);
+   return (double)size * size * nb_frames * CLOCKS_PER_SEC / (double)t;
+}
+
+/* pixels per second of a frame renderer on the size x size square */
+double bench_frame(
+   void (*frame)(int, int, int, int, int, iter_t*),
+   int size, iter_t* iter
+) {
+   int d = (xmax-xmin)/size;
+   int nb_frames = 0;
+   clock_t start = clock(), t;
+   do {
+      frame(xmin, ymin, d, size, size, iter);
+      ++nb_frames;
+      t = clock() - start;
+   } while(t < CLOCKS_PER_SEC / 4);
+   return (double)size * size * nb_frames * CLOCKS_PER_SEC / (double)t;
+}
+
+/* number of different iteration counts */
+int nb_diffs(const iter_t* a, const iter_t* b, int n) {
+   int result = 0;
+   for(int i=0; i<n; ++i) {
+      result += (a[i] != b[i]);
+   }
+   return result;
+}
+
+static void mp_from_double(mp_t* r, double x) {
+   int neg = x < 0.0;
+   if(neg) {
+      x = -x;
+   }
+   for(int i=MP_WORDS-1; i>=0; --i) {
+      r->w[i] = (unsigned int)x;
+      x = (x - (double)r->w[i]) * 4294967296.0;
+   }
+   if(neg) {
+      mp_neg(r);
+   }
+}
+
+/* mandel() in multi-word fixed point, for C + dCr + i*dCi */
+int mandel_mp(const mp_t* Cr, const mp_t* Ci, double dCr, double dCi) {
+   mp_t cr, ci, zr, zi, zrr, zii, zri;
+   mp_from_double(&cr, dCr);
+   mp_from_double(&ci, dCi);
+   mp_add(&cr, &cr, Cr);
+   mp_add(&ci, &ci, Ci);
+   memset(&zr, 0, sizeof(mp_t));
+   memset(&zi, 0, sizeof(mp_t));
+   int iter = max_iter;
+   while(iter > 0) {
+      mp_mul(&zrr, &zr, &zr);
+      mp_mul(&zii, &zi, &zi);
+      mp_mul(&zri, &zr, &zi);
+      mp_sub(&zr, &zrr, &zii);
+      mp_add(&zr, &zr, &cr);
+      mp_add(&zi, &zri, &zri);
+      mp_add(&zi, &zi, &ci);
+      double r = mp_to_double(&zr);
+      double i = mp_to_double(&zi);
+      if(r*r + i*i > 4.0) {
+	 break;
+      }
+      --iter;
+   }
+   return iter;
+}
+
+int bench() {
+   static const int caps[] = { 20, 256, 1000, 5000 };
+   static const int depths[] = { 0, 20, 50, 100 };
+   int nb_errors = 0;
+   iter_t* ref  = malloc(sizeof(iter_t) * 2048 * 2048);
+   iter_t* iter = malloc(sizeof(iter_t) * 2048 * 2048);
+#ifdef MANDEL_SIMD
+   printf("SIMD kernel: %d lanes\n", MANDEL_LANES);
+#else
+   printf("SIMD kernel: not available (compile with -mavx2 or -msse4.1)\n");
+#endif
+   for(int i = 0; i < BENCH_SIZES; ++i) {
+      int size = bench_sizes[i];
+      double scalar = bench_kernel(mandel_row_scalar, size, ref);
+      double simd   = bench_kernel(mandel_row, size, iter);
+      int diffs = nb_diffs(ref, iter, size*size);
+      nb_errors += diffs;
+      printf(
+	 "%5dx%-5d scalar: %8.2f Mpix/s  simd: %8.2f Mpix/s  x%.2f  %s\n",
+	 size, size, scalar * 1e-6, simd * 1e-6, simd / scalar,
+	 diffs ? "MISMATCH" : "ok"
+      );
+   }
+   printf("Interior tests (cardioid/bulb, periodicity), 1024x1024:\n");
+   for(int i = 0; i < (int)(sizeof(caps)/sizeof(caps[0])); ++i) {
+      max_iter = caps[i];
+      interior_tests = 0;
+      double off = bench_frame(mandel_frame, 1024, ref);
+      interior_tests = 1;
+      double on = bench_frame(mandel_frame, 1024, iter);
+      int diffs = nb_diffs(ref, iter, 1024*1024);
+      nb_errors += diffs;
+      printf(
+	 "max_iter %5d  off: %8.2f Mpix/s  on: %8.2f Mpix/s  x%.2f  %s\n",
+	 max_iter, off * 1e-6, on * 1e-6, on / off,
+	 diffs ? "MISMATCH" : "ok"
+      );
+   }
+   printf(
+      "Perturbation, %dx%d around the seahorse valley point (multi-word:"
+      " 1 pixel out of %dx%d):\n", W, H, BENCH_MP_STEP, BENCH_MP_STEP
+   );
+   for(int i = 0; i < (int)(sizeof(depths)/sizeof(depths[0])); ++i) {
+      mp_t Cr, Ci;
+      mp_from_string(&Cr, zoom_center[0]);
+      mp_from_string(&Ci, zoom_center[1]);
+      max_iter = zoom_iter(depths[i]); // so that the pixels escape
+      double d = 4.0 / H;
+      for(int k=0; k<depths[i]; ++k) {
+	 d *= 0.5;
+      }
+      clock_t t0 = clock();
+      mandel_frame_perturb(&Cr, &Ci, d, W, H, iter);
+      clock_t t1 = clock();
+      int nb_pixels = 0, diffs = 0, chaotic = 0;
+      for(int Y=0; Y<H; Y+=BENCH_MP_STEP) {
+	 for(int X=0; X<W; X+=BENCH_MP_STEP) {
+	    double dCr = (X - W/2) * d, dCi = (Y - H/2) * d;
+	    iter_t r = mandel_mp(&Cr, &Ci, dCr, dCi);
+	    if(r != iter[Y*W+X]) {
+	       // Chaotic pixels, whose count changes when the point moves by
+	       // a tiny fraction of a pixel, cannot be followed by deltas in
+	       // double precision: only the other ones are errors.
+	       if(mandel_mp(&Cr, &Ci, dCr + BENCH_MP_CHAOS * d, dCi) != r) {
+		  ++chaotic;
+	       } else {
+		  ++diffs;
+	       }
+	    }
+	    ++nb_pixels;
+	 }
+      }
+      clock_t t2 = clock();
+      // a flat frame (nothing escapes, or everything at once) proves nothing
+      int nb_counts = 0;
+      for(int p=0; p<W*H && nb_counts<2; ++p) {
+	 nb_counts = (iter[p] != iter[0]) ? 2 : 1;
+      }
+      nb_errors += diffs + (nb_counts < 2);
+      double perturb_rate = (double)(W*H) * CLOCKS_PER_SEC / (double)(t1-t0+1);
+      double mp_rate = (double)nb_pixels * CLOCKS_PER_SEC / (double)(t2-t1+1);
+      printf(
+	 "zoom 2^%-3d  max_iter %5d  perturbation: %8.4f Mpix/s"
+	 "  multi-word: %8.4f Mpix/s  x%.1f  %d diff(s) (+%d chaotic)  %s\n",
+	 depths[i], max_iter, perturb_rate * 1e-6, mp_rate * 1e-6,
+	 perturb_rate / mp_rate, diffs, chaotic,
+	 nb_counts < 2 ? "FLAT" : diffs ? "MISMATCH" : "ok"
+      );
+   }
+   max_iter = 1000;
+#ifdef MANDEL_THREADS
+   for(int i = 0; i < 2; ++i) {
+      int w = i ? 1920 : W;
+      int h = i ? 1080 : H;
+      int d = (ymax-ymin)/h;
+      int x0 = -(mandel_mul/2) - (w/2)*d; // centered on -1/2
+      int nb_threads = mandel_nb_threads();
+      double busy[MANDEL_MAX_THREADS];
+      if(nb_threads > MANDEL_MAX_THREADS) {
+	 nb_threads = MANDEL_MAX_THREADS;
+      }
+      double t0 = mandel_now();
+      mandel_frame(x0, ymin, d, w, h, ref);
+      double t1 = mandel_now();
+      mandel_frame_mt(x0, ymin, d, w, h, iter, nb_threads, busy);
+      double t2 = mandel_now();
+      int diffs = nb_diffs(ref, iter, w*h);
+      nb_errors += diffs;
+      printf(
+	 "Threads, %dx%d, max_iter %d: 1 thread %.4fs, %d threads %.4fs"
+	 "  x%.2f  %s\n", w, h, max_iter, t1 - t0, nb_threads, t2 - t1,
+	 (t1 - t0) / (t2 - t1), diffs ? "MISMATCH" : "ok"
+      );
+      printf("   busy:");
+      for(int t=0; t<nb_threads; ++t) {
+	 printf(" %.4fs", busy[t]);
+      }
+      printf("\n");
+   }
+#endif
+   printf("Automatic precision, 256x256 around the seahorse valley point:\n");
+   for(int depth = 0; depth <= 56; depth += 8) {
+      mp_t Cr, Ci;
+      mp_from_string(&Cr, zoom_center[0]);
+      mp_from_string(&Ci, zoom_center[1]);
+      mandel_coord_t d = ((mandel_coord_t)4 << MANDEL_COORD_SHIFT) / 256;
+      d >>= depth;
+      mandel_coord_t x0 = mp_to_coord(&Cr) - 128*d;
+      mandel_coord_t y0 = mp_to_coord(&Ci) - 128*d;
+      clock_t t0 = clock();
+      int shift = mandel_frame_auto(x0, y0, d, 256, 256, iter);
+      clock_t t1 = clock();
+      mandel_frame_fixed(MANDEL_COORD_SHIFT, x0, y0, d, 256, 256, ref);
+      clock_t t2 = clock();
+      printf(
+	 "zoom 2^%-3d  Q%-2d%s: %8.3f Mpix/s  Q%d: %8.3f Mpix/s  %d diff(s)\n",
+	 depth, shift, mandel_format(d) < 0 ? " (not precise enough)" : "",
+	 (double)(256*256) * CLOCKS_PER_SEC / (double)(t1 - t0 + 1) * 1e-6,
+	 MANDEL_COORD_SHIFT,
+	 (double)(256*256) * CLOCKS_PER_SEC / (double)(t2 - t1 + 1) * 1e-6,
+	 nb_diffs(ref, iter, 256*256)
+      );
+   }
+   printf("Non-power-of-two spacings, 64x64, compared pixel by pixel:\n");
+   for(int depth = 0; depth <= 24; depth += 8) {
+      mp_t Cr, Ci;
+      mp_from_string(&Cr, zoom_center[0]);
+      mp_from_string(&Ci, zoom_center[1]);
+      // almost 17 units of the format chosen for 2^(depth+6)
+      mandel_coord_t d =
+	 ((mandel_coord_t)17 << (MANDEL_COORD_SHIFT - 10 - depth)) - 1;
+      mandel_coord_t x0 = mp_to_coord(&Cr) - 32*d;
+      mandel_coord_t y0 = mp_to_coord(&Ci) - 32*d;
+      int shift = mandel_frame_auto(x0, y0, d, 64, 64, iter);
+      int diffs = 0;
+      for(int Y=0; Y<64; ++Y) {
+	 for(int X=0; X<64; ++X) {
+	    iter_t pixel;
+	    mandel_frame_auto(x0 + X*d, y0 + Y*d, d, 1, 1, &pixel);
+	    diffs += (pixel != iter[Y*64+X]);
+	 }
+      }
+      nb_errors += diffs;
+      printf(
+	 "zoom 2^%-3d  Q%-2d  %d diff(s)  %s\n",
+	 depth, shift, diffs, diffs ? "MISMATCH" : "ok"
+      );
+   }
+   printf("Zoom reuse, 128x128, 2x per frame from a spacing of 2^-6:\n");
+   {
+      mp_t Cr, Ci;
+      MandelCache cache;
+      mp_from_string(&Cr, zoom_center[0]);
+      mp_from_string(&Ci, zoom_center[1]);
+      mandel_cache_init(&cache);
+      mandel_coord_t d = (mandel_coord_t)1 << (MANDEL_COORD_SHIFT - 6);
+      clock_t t_auto = 0, t_cached = 0;
+      long long computed = 0;
+      int nb_frames = 0, diffs = 0;
+      for(; mandel_format(d) >= 0 && nb_frames <= 20; ++nb_frames, d >>= 1) {
+	 mandel_coord_t x0 = mp_to_coord(&Cr) - 64*d;
+	 mandel_coord_t y0 = mp_to_coord(&Ci) - 64*d;
+	 clock_t t0 = clock();
+	 mandel_frame_auto(x0, y0, d, 128, 128, ref);
+	 clock_t t1 = clock();
+	 computed += mandel_frame_cached(&cache, x0, y0, d, 128, 128, iter);
+	 clock_t t2 = clock();
+	 t_auto   += t1 - t0;
+	 t_cached += t2 - t1;
+	 diffs += nb_diffs(ref, iter, 128*128);
+      }
+      mandel_cache_free(&cache);
+      nb_errors += diffs;
+      printf(
+	 "%d frames  auto: %.3fs  cached: %.3fs  x%.2f  %.1f%% computed  %s\n",
+	 nb_frames, (double)t_auto / CLOCKS_PER_SEC,
+	 (double)t_cached / CLOCKS_PER_SEC,
+	 (double)t_auto / (double)(t_cached + 1),
+	 100.0 * (double)computed / (128.0 * 128.0 * nb_frames),
+	 diffs ? "MISMATCH" : "ok"
+      );
+   }
+   max_iter = 1000;
+   printf("Progressive rendering, max_iter %d:\n", max_iter);
+   for(int i = 0; i < BENCH_SIZES; ++i) {
+      int size = bench_sizes[i];
+      int d = (xmax-xmin)/size;
+      int computed = 0;
+      clock_t first = 0;
+      clock_t t0 = clock();
+      mandel_frame(xmin, ymin, d, size, size, ref);
+      clock_t t1 = clock();
+      for(int step = MANDEL_PROG_STEP; step >= 1; step /= 2) {
+	 computed += mandel_frame_pass(xmin, ymin, d, size, size, iter, step);
+	 if(step == MANDEL_PROG_STEP) {
+	    first = clock() - t1;
+	 }
+      }
+      clock_t t2 = clock();
+      int diffs = nb_diffs(ref, iter, size*size);
+      nb_errors += diffs + (computed != size*size);
+      printf(
+	 "%5dx%-5d frame: %.4fs  first pass: %.4fs  all passes: %.4fs"
+	 "  %d/%d pixels computed  %s\n",
+	 size, size, (double)(t1 - t0) / CLOCKS_PER_SEC,
+	 (double)first / CLOCKS_PER_SEC, (double)(t2 - t1) / CLOCKS_PER_SEC,
+	 computed, size*size,
+	 diffs || computed != size*size ? "MISMATCH" : "ok"
+      );
+   }
+   free(ref);
+   free(iter);
+   return nb_errors ? 1 : 0;
+}
+
+#endif
+
 int main() {
+#ifdef MANDEL_BENCH
+   return bench();
+#endif
+#ifdef MANDEL_ZOOM
+   return zoom();
+#endif
    int frame=0;
+#ifdef MANDEL_PROGRESSIVE
+   for(int step = MANDEL_PROG_STEP; step >= 1; step /= 2) {
+      mandel_frame_pass(xmin, ymin, dx, W, H, iters[0], step);
+      printf("\033[H");
+      for(int Y=0; Y<H; ++Y) {
+	 show_row(iters[Y], W, 0);
+      }
+   }
+#elif defined(MANDEL_THREADS)
+   mandel_frame_mt(xmin, ymin, dx, W, H, iters[0], mandel_nb_threads(), NULL);
+#else
+   mandel_frame(xmin, ymin, dx, W, H, iters[0]);
+#endif
    for(;;) {
       // IO_OUT(IO_LEDS,frame);
-      int last_color = -1;
       printf("\033[H");
-      int Ci = ymin;
       for(int Y=0; Y<H; ++Y) {
-	 int Cr = xmin;
-	 for(int X=0; X<W; ++X) {
-	    int Zr = Cr;
-	    int Zi = Ci;
-	    int iter = 20;
-	    while(iter > 0) {
-	       int Zrr = (Zr * Zr) >> mandel_shift;
-	       int Zii = (Zi * Zi) >> mandel_shift;
-	       int Zri = (Zr * Zi) >> (mandel_shift - 1);
-	       Zr = Zrr - Zii + Cr;
-	       Zi = Zri + Ci;
-	       if(Zrr + Zii > norm_max) {
-		  break;
-	       }
-	       --iter;
-	    }
-	    int color = (iter+frame)%21;
-	    printf("%s", color == last_color ? "  " : colormap[color]);
-	    last_color = color;
-	    Cr += dx;
-	 }
-	 Ci += dy;
-	 printf("\033[49m\n");	 
-	 last_color = -1;
+	 show_row(iters[Y], W, frame);
       }
       ++frame;
 #ifdef __linux__       
@@ -23,7 +23,7 @@
     // Bruno TODO: find a way of:
     // [x] get rid of sqrtf()
     // [ ] implementing mul_mod() using int32 arithmetics 
-    // [ ] replace log() and fmod() by int32 arithmetics
+    // [x] replace log() and fmod() by int32 arithmetics
 
 
 //#define RV32_FASTCODE __attribute((section(".fastcode")))
@@ -38,6 +38,18 @@
 #define mul_mod(a,b,m) fmod( (double) a * (double) b, m)
 #endif
 
+/* compile with -DPI_PRIME_CACHE='"primes.bin"' to take the primes from a
+   file written by sieve.c (./sieve <limit> -o primes.bin), see prime_cache.h */
+#ifdef PI_PRIME_CACHE
+#include "prime_cache.h"
+PrimeCache prime_cache;
+#endif
+
+/* Number of terms of the k loop whose denominators are inverted together
+ * (Montgomery's simultaneous inversion): one inv_mod() per block instead
+ * of one per term. Set to 1 to get back one inversion per term. */
+#define INV_BATCH 32
+
 /* return the inverse of x mod y */
 int inv_mod(int x, int y) RV32_FASTCODE;
 int inv_mod(int x, int y)
@@ -107,26 +119,563 @@ int is_prime(int n)
 int next_prime(int n) RV32_FASTCODE;
 int next_prime(int n)
 {
+#ifdef PI_PRIME_CACHE
+    int p;
+    if ((p = PrimeCache_next_prime(&prime_cache, n)) != 0)
+    return p;
+#endif
     do {
     n++;
     } while (!is_prime(n));
     return n;
 }
 
+/* return (s + sum(num[i] / den[i])) mod m, using a single inv_mod()
+   and three mul_mod() per element */
+int sum_inv_batch(int s, int* num, int* den, int nb, int m) RV32_FASTCODE;
+int sum_inv_batch(int s, int* num, int* den, int nb, int m)
+{
+    int prod[INV_BATCH], inv, t, i;
+
+    if (nb == 0)
+    return s;
+
+    /* prod[i] = den[0] * ... * den[i] */
+    prod[0] = den[0];
+    for (i = 1; i < nb; i++)
+    prod[i] = mul_mod(prod[i - 1], den[i], m);
+
+    /* inv = 1 / (den[0] * ... * den[i]), peeled one den[i] at a time */
+    inv = inv_mod(prod[nb - 1], m);
+    for (i = nb - 1; i >= 0; i--) {
+    if (i > 0) {
+        t = mul_mod(inv, prod[i - 1], m); /* 1 / den[i] */
+        inv = mul_mod(inv, den[i], m);
+    } else {
+        t = inv;
+    }
+    t = mul_mod(t, num[i], m);
+    s += t;
+    if (s >= m)
+        s -= m;
+    }
+    return s;
+}
+
+/* return floor(x * y / 2^32), and (x * y) mod 2^32 in *lo */
+unsigned int mul_hi32(unsigned int x, unsigned int y, unsigned int* lo)
+    RV32_FASTCODE;
+unsigned int mul_hi32(unsigned int x, unsigned int y, unsigned int* lo)
+{
+    unsigned int xh, xl, yh, yl, hh, hl, lh, ll, t;
+
+    xh = x >> 16;
+    xl = x & 0xffff;
+    yh = y >> 16;
+    yl = y & 0xffff;
+    hh = xh * yh;
+    hl = xh * yl;
+    lh = xl * yh;
+    ll = xl * yl;
+    t = (ll >> 16) + (hl & 0xffff) + (lh & 0xffff);
+    *lo = (t << 16) | (ll & 0xffff);
+    return hh + (hl >> 16) + (lh >> 16) + (t >> 16);
+}
+
+/* return floor(r * 2^32 / m) and replace r by (r * 2^32) mod m,
+   for 0 <= r < m < 2^31 */
+unsigned int div_frac32(unsigned int* r, unsigned int m) RV32_FASTCODE;
+unsigned int div_frac32(unsigned int* r, unsigned int m)
+{
+    unsigned int q, x;
+    int i;
+
+    q = 0;
+    x = *r;
+    for (i = 0; i < 32; i++) {
+    x <<= 1;
+    q <<= 1;
+    if (x >= m) {
+        x -= m;
+        q |= 1;
+    }
+    }
+    *r = x;
+    return q;
+}
+
+/* return floor(m * log2(10)) for 0 <= m < 2^29, with
+   log2(10) = 3 + (LOG2_10_HI * 2^32 + LOG2_10_LO) / 2^64 */
+#define LOG2_10_HI 0x5269e12fu
+#define LOG2_10_LO 0x346e2bf9u
+int log2_10_mul(int m) RV32_FASTCODE;
+int log2_10_mul(int m)
+{
+    unsigned int h, l, t, u;
+
+    h = mul_hi32(m, LOG2_10_HI, &l);
+    t = mul_hi32(m, LOG2_10_LO, &u);
+    l += t;
+    if (l < t)
+    h++;
+    return 3 * m + h;
+}
+
+/* sum += s / av, sum being a 64 bits fixed point number in [0,1) stored
+   in sum[0].sum[1]: wrapping around gives the fractional part for free */
+void frac_add(unsigned int* sum, int s, int av) RV32_FASTCODE;
+void frac_add(unsigned int* sum, int s, int av)
+{
+    unsigned int r, h, l;
+
+    r = s;
+    h = div_frac32(&r, av);
+    l = div_frac32(&r, av);
+    sum[1] += l;
+    sum[0] += h + (sum[1] < l);
+}
+
+/* return av = a^vmax, with vmax = floor(log(2N) / log(a)) */
+int max_pow(int a, int N, int* vmax) RV32_FASTCODE;
+int max_pow(int a, int N, int* vmax)
+{
+    int av;
+
+    *vmax = 0;
+    av = 1;
+    while (av <= (2 * N) / a) {
+    av = av * a;
+    (*vmax)++;
+    }
+    return av;
+}
+
+/* return the contribution s of prime a, such that the contribution to
+   the fractional part is s / av */
+int prime_sum(int a, int N, int n, int* pav) RV32_FASTCODE;
+int prime_sum(int a, int N, int n, int* pav)
+{
+    int av, vmax, num, den, k, kq, kq2, t, v, s, i;
+    int bnum[INV_BATCH], bden[INV_BATCH], nb;
+
+    av = max_pow(a, N, &vmax);
+    *pav = av;
+
+    s = 0;
+    num = 1;
+    den = 1;
+    v = 0;
+    kq = 1;
+    kq2 = 1;
+    nb = 0;
+
+    for (k = 1; k <= N; k++) {
+
+    t = k;
+    if (kq >= a) {
+        do {
+        t = t / a;
+        v--;
+        } while ((t % a) == 0);
+        kq = 0;
+    }
+    kq++;
+    num = mul_mod(num, t, av);
+
+    t = (2 * k - 1);
+    if (kq2 >= a) {
+        if (kq2 == a) {
+        do {
+            t = t / a;
+            v++;
+        } while ((t % a) == 0);
+        }
+        kq2 -= a;
+    }
+    den = mul_mod(den, t, av);
+    kq2 += 2;
+
+    if (v > 0) {
+        t = mul_mod(num, k, av);
+        for (i = v; i < vmax; i++)
+        t = mul_mod(t, a, av);
+        bnum[nb] = t;
+        bden[nb] = den;
+        if (++nb == INV_BATCH) {
+        s = sum_inv_batch(s, bnum, bden, nb, av);
+        nb = 0;
+        }
+    }
+
+    }
+    s = sum_inv_batch(s, bnum, bden, nb, av);
+
+    t = pow_mod(10, n - 1, av);
+    return mul_mod(s, t, av);
+}
+
+/*
+ * SIMD version: the k loop has the same control flow for all primes
+ * (except the rare kq >= a branches), so PI_LANES primes are processed
+ * in lockstep, one prime per lane. Modular products are computed with
+ * doubles: p = x * y is exact as long as av < 2^26, and the quotient
+ * p / av is rounded with the 1.5 * 2^52 trick. Enabled on AArch64, and
+ * on x86 when compiling with -mavx2 (or -march=native).
+ */
+#if defined(__GNUC__) && (defined(__AVX2__) || defined(__aarch64__))
+#define PI_SIMD
+#endif
+
+#ifdef PI_SIMD
+
+/* 8 lanes fill an AVX-512 register, 4 lanes an AVX2 one (or two NEON ones) */
+#ifdef __AVX512F__
+#define PI_LANES 8
+#else
+#define PI_LANES 4
+#endif
+#define PI_SIMD_MAX_AV (1 << 26)
+
+typedef double    vdouble __attribute__((vector_size(8 * PI_LANES)));
+typedef long long vlong   __attribute__((vector_size(8 * PI_LANES)));
+
+/* (x * y) mod m, with im = 1/m and x * y < 2^52 */
+static inline vdouble vmul_mod(vdouble x, vdouble y, vdouble m, vdouble im)
+{
+    vdouble p, q, r;
+
+    p = x * y;
+    q = (p * im + 0x1.8p52) - 0x1.8p52; /* round(p / m) */
+    r = p - q * m;                       /* in [-m, m) */
+    return r + (vdouble)((vlong)m & (vlong)(r < 0));
+}
+
+/* lane-wise sum_inv_batch(), one inv_mod() per lane */
+static vdouble vsum_inv_batch(
+    vdouble s, vdouble* num, vdouble* den, int nb, vdouble m, vdouble im
+)
+{
+    vdouble prod[INV_BATCH], inv, t;
+    int i, l;
+
+    if (nb == 0)
+    return s;
+
+    prod[0] = den[0];
+    for (i = 1; i < nb; i++)
+    prod[i] = vmul_mod(prod[i - 1], den[i], m, im);
+
+    for (l = 0; l < PI_LANES; l++)
+    inv[l] = inv_mod((int)prod[nb - 1][l], (int)m[l]);
+    for (i = nb - 1; i >= 0; i--) {
+    if (i > 0) {
+        t = vmul_mod(inv, prod[i - 1], m, im);
+        inv = vmul_mod(inv, den[i], m, im);
+    } else {
+        t = inv;
+    }
+    s += vmul_mod(t, num[i], m, im);
+    s -= (vdouble)((vlong)m & (vlong)(s >= m));
+    }
+    return s;
+}
+
+/* prime_sum() for the PI_LANES primes in la[], results in ls[] and lav[] */
+void prime_sum_simd(int* la, int N, int n, int* ls, int* lav)
+{
+    int a[PI_LANES], vmax[PI_LANES], v[PI_LANES];
+    int next1[PI_LANES], next2[PI_LANES];
+    double apow[PI_LANES][32];
+    vdouble zero = {0}, m, im, num, den, s, T1, T2, P, t;
+    vdouble bnum[INV_BATCH], bden[INV_BATCH];
+    int k, kfix, l, i, nb, tt;
+
+    kfix = N + 1;
+    for (l = 0; l < PI_LANES; l++) {
+    a[l] = la[l];
+    m[l] = max_pow(a[l], N, &vmax[l]);
+    im[l] = 1.0 / m[l];
+    /* apow[v] = a^(vmax-v), the factor applied by the scalar loop */
+    apow[l][vmax[l]] = 1;
+    for (i = vmax[l] - 1; i >= 0; i--)
+        apow[l][i] = mul_mod((int)apow[l][i + 1], a[l], (int)m[l]);
+    v[l] = 0;
+    P[l] = 0;
+    /* next k such that a divides k, and such that a divides 2k-1
+       (this is what the kq and kq2 counters detect in prime_sum()) */
+    next1[l] = a[l];
+    next2[l] = (a[l] + 1) / 2;
+    kfix = next2[l] < kfix ? next2[l] : kfix;
+    }
+
+    s = zero;
+    num = zero + 1;
+    den = zero + 1;
+    nb = 0;
+
+    for (k = 1; k <= N; k++) {
+
+    T1 = zero + k;
+    T2 = zero + (2 * k - 1);
+
+    /* divisibility bookkeeping, only for the k where a lane needs it */
+    if (k == kfix) {
+        kfix = N + 1;
+        for (l = 0; l < PI_LANES; l++) {
+        if (next1[l] == k) {
+            tt = k;
+            do {
+            tt = tt / a[l];
+            v[l]--;
+            } while ((tt % a[l]) == 0);
+            T1[l] = tt;
+            next1[l] += a[l];
+        }
+        if (next2[l] == k) {
+            tt = 2 * k - 1;
+            do {
+            tt = tt / a[l];
+            v[l]++;
+            } while ((tt % a[l]) == 0);
+            T2[l] = tt;
+            next2[l] += a[l];
+        }
+        P[l] = v[l] > 0 ? apow[l][v[l] < vmax[l] ? v[l] : vmax[l]] : 0;
+        kfix = next1[l] < kfix ? next1[l] : kfix;
+        kfix = next2[l] < kfix ? next2[l] : kfix;
+        }
+    }
+
+    num = vmul_mod(num, T1, m, im);
+    den = vmul_mod(den, T2, m, im);
+
+    /* lanes with v <= 0 have P = 0 and contribute nothing */
+    t = vmul_mod(num, zero + k, m, im);
+    bnum[nb] = vmul_mod(t, P, m, im);
+    bden[nb] = den;
+    if (++nb == INV_BATCH) {
+        s = vsum_inv_batch(s, bnum, bden, nb, m, im);
+        nb = 0;
+    }
+    }
+    s = vsum_inv_batch(s, bnum, bden, nb, m, im);
+
+    for (l = 0; l < PI_LANES; l++) {
+    lav[l] = (int)m[l];
+    tt = pow_mod(10, n - 1, lav[l]);
+    ls[l] = mul_mod((int)s[l], tt, lav[l]);
+    }
+}
+
+#endif
+
+/* return the 9 decimals of pi starting at position n, for 2N < PI_MAX_N32
+   (see digits64() for larger n) */
 int digits(int n) RV32_FASTCODE;
 int digits(int n) {
-    int av, a, vmax, N, num, den, k, kq, kq2, t, v, s, i;
-    double sum;
+    int a, N, av, s;
+    unsigned int sum[2], r, h, l;
+#ifdef PI_SIMD
+    int la[PI_LANES], ls[PI_LANES], lav[PI_LANES], i, nl;
+    nl = 0;
+#endif
 
-    N = (int) ((n + 20) * log(10) / log(2));
-    sum = 0;
+    N = log2_10_mul(n + 20);
+    sum[0] = 0;
+    sum[1] = 0;
 
     for (a = 3; a <= (2 * N); a = next_prime(a)) {
+#ifdef PI_SIMD
+    if (2 * N < PI_SIMD_MAX_AV) {
+        la[nl++] = a;
+        if (nl == PI_LANES) {
+        prime_sum_simd(la, N, n, ls, lav);
+        for (i = 0; i < PI_LANES; i++)
+            frac_add(sum, ls[i], lav[i]);
+        nl = 0;
+        }
+        continue;
+    }
+#endif
+    s = prime_sum(a, N, n, &av);
+    frac_add(sum, s, av);
+    }
+
+#ifdef PI_SIMD
+    /* primes left over by the last incomplete group of lanes */
+    for (i = 0; i < nl; i++) {
+    s = prime_sum(la[i], N, n, &av);
+    frac_add(sum, s, av);
+    }
+#endif
+
+    /* return floor(sum * 1e9) */
+    r = mul_hi32(sum[1], 1000000000, &l);
+    h = mul_hi32(sum[0], 1000000000, &l);
+    l += r;
+    if (l < r)
+    h++;
+    return h;
+}
+
+
+/*
+ * Wide engine, for digit positions where N or av do not fit in 32 bits:
+ * same algorithm as prime_sum() and digits(), with 64 bits moduli. The
+ * modular product uses unsigned __int128 when the compiler has it, and a
+ * shift-and-add loop otherwise (RV32).
+ */
+
+typedef unsigned long long u64;
 
-    vmax = (int) (log(2 * N) / log(a));
+/* the 32 bits engine is used while 2N < PI_MAX_N32 */
+#ifdef HAS_LONG_LONG
+#define PI_MAX_N32 (1 << 30)
+#else
+#define PI_MAX_N32 (1 << 26) /* fmod() is exact while av^2 < 2^53 */
+#endif
+
+/* return (a * b) mod m, for a, b < m < 2^63 */
+u64 mul_mod64(u64 a, u64 b, u64 m)
+{
+#ifdef __SIZEOF_INT128__
+    return (u64)(((unsigned __int128)a * b) % m);
+#else
+    u64 r = 0;
+    a %= m;
+    while (b != 0) {
+    if (b & 1) {
+        r += a;
+        if (r >= m)
+        r -= m;
+    }
+    a += a;
+    if (a >= m)
+        a -= m;
+    b >>= 1;
+    }
+    return r;
+#endif
+}
+
+/* return floor(x * y / 2^64) */
+u64 mul_hi64(u64 x, u64 y)
+{
+    u64 xh, xl, yh, yl, hl, lh, t;
+
+    xh = x >> 32;
+    xl = x & 0xffffffff;
+    yh = y >> 32;
+    yl = y & 0xffffffff;
+    hl = xh * yl;
+    lh = xl * yh;
+    t = ((xl * yl) >> 32) + (hl & 0xffffffff) + (lh & 0xffffffff);
+    return xh * yh + (hl >> 32) + (lh >> 32) + (t >> 32);
+}
+
+/* return the inverse of x mod y */
+u64 inv_mod64(u64 x, u64 y)
+{
+    long long q, u, v, a, c, t;
+
+    u = x;
+    v = y;
+    c = 1;
+    a = 0;
+    do {
+    q = v / u;
+
+    t = c;
+    c = a - q * c;
+    a = t;
+
+    t = u;
+    u = v - q * u;
+    v = t;
+    } while (u != 0);
+    a = a % (long long)y;
+    if (a < 0)
+    a = y + a;
+    return a;
+}
+
+/* return (a^b) mod m */
+u64 pow_mod64(u64 a, u64 b, u64 m)
+{
+    u64 r, aa;
+
+    r = 1;
+    aa = a;
+    while (1) {
+    if (b & 1)
+        r = mul_mod64(r, aa, m);
+    b = b >> 1;
+    if (b == 0)
+        break;
+    aa = mul_mod64(aa, aa, m);
+    }
+    return r;
+}
+
+/* return the prime number immediatly after n */
+u64 next_prime64(u64 n)
+{
+    u64 i;
+
+#ifdef PI_PRIME_CACHE
+    if ((i = PrimeCache_next_prime(&prime_cache, n)) != 0)
+    return i;
+#endif
+    for (n = (n + 1) | 1; ; n += 2) {
+    for (i = 3; i * i <= n; i += 2)
+        if ((n % i) == 0)
+        break;
+    if (i * i > n)
+        return n;
+    }
+}
+
+/* return (s + sum(num[i] / den[i])) mod m */
+u64 sum_inv_batch64(u64 s, u64* num, u64* den, int nb, u64 m)
+{
+    u64 prod[INV_BATCH], inv, t;
+    int i;
+
+    if (nb == 0)
+    return s;
+
+    prod[0] = den[0];
+    for (i = 1; i < nb; i++)
+    prod[i] = mul_mod64(prod[i - 1], den[i], m);
+
+    inv = inv_mod64(prod[nb - 1], m);
+    for (i = nb - 1; i >= 0; i--) {
+    if (i > 0) {
+        t = mul_mod64(inv, prod[i - 1], m);
+        inv = mul_mod64(inv, den[i], m);
+    } else {
+        t = inv;
+    }
+    s += mul_mod64(t, num[i], m);
+    if (s >= m)
+        s -= m;
+    }
+    return s;
+}
+
+/* prime_sum() with 64 bits moduli */
+u64 prime_sum64(u64 a, u64 N, u64 n, u64* pav)
+{
+    u64 av, num, den, k, kq, kq2, t, s, bnum[INV_BATCH], bden[INV_BATCH];
+    int vmax, v, i, nb;
+
+    vmax = 0;
     av = 1;
-    for (i = 0; i < vmax; i++)
-        av = av * a;
+    while (av <= (2 * N) / a) {
+    av = av * a;
+    vmax++;
+    }
+    *pav = av;
 
     s = 0;
     num = 1;
@@ -134,56 +683,206 @@ int digits(int n) {
     v = 0;
     kq = 1;
     kq2 = 1;
+    nb = 0;
 
     for (k = 1; k <= N; k++) {
 
-        t = k;
-        if (kq >= a) {
+    t = k;
+    if (kq >= a) {
         do {
-            t = t / a;
-            v--;
+        t = t / a;
+        v--;
         } while ((t % a) == 0);
         kq = 0;
-        }
-        kq++;
-        num = mul_mod(num, t, av);
+    }
+    kq++;
+    num = mul_mod64(num, t, av);
 
-        t = (2 * k - 1);
-        if (kq2 >= a) {
+    t = (2 * k - 1);
+    if (kq2 >= a) {
         if (kq2 == a) {
-            do {
+        do {
             t = t / a;
             v++;
-            } while ((t % a) == 0);
+        } while ((t % a) == 0);
         }
         kq2 -= a;
-        }
-        den = mul_mod(den, t, av);
-        kq2 += 2;
+    }
+    den = mul_mod64(den, t, av);
+    kq2 += 2;
 
-        if (v > 0) {
-        t = inv_mod(den, av);
-        t = mul_mod(t, num, av);
-        t = mul_mod(t, k, av);
+    if (v > 0) {
+        t = mul_mod64(num, k, av);
         for (i = v; i < vmax; i++)
-            t = mul_mod(t, a, av);
-        s += t;
-        if (s >= av)
-            s -= av;
+        t = mul_mod64(t, a, av);
+        bnum[nb] = t;
+        bden[nb] = den;
+        if (++nb == INV_BATCH) {
+        s = sum_inv_batch64(s, bnum, bden, nb, av);
+        nb = 0;
         }
+    }
 
     }
+    s = sum_inv_batch64(s, bnum, bden, nb, av);
 
-    t = pow_mod(10, n - 1, av);
-    s = mul_mod(s, t, av);
-       
-    sum = fmod(sum + (double) s / (double) av, 1.0);
+    t = pow_mod64(10, n - 1, av);
+    return mul_mod64(s, t, av);
+}
+
+/* return floor(s * 2^64 / m), for s < m < 2^63 */
+u64 div_frac64(u64 s, u64 m)
+{
+    u64 q;
+    int i;
+
+    q = 0;
+    for (i = 0; i < 64; i++) {
+    s <<= 1;
+    q <<= 1;
+    if (s >= m) {
+        s -= m;
+        q |= 1;
+    }
     }
-    return (int) (sum * 1e9);
+    return q;
 }
 
+/* digits() for any position n: uses the 32 bits engine when it can */
+int digits64(u64 n)
+{
+    u64 a, N, av, s, sum;
+
+    /* N = floor((n+20) * log2(10)), see log2_10_mul() */
+    N = 3 * (n + 20) + mul_hi64(n + 20, 0x5269e12f346e2bf9ull);
+    if (2 * N < PI_MAX_N32)
+    return digits((int)n);
+
+    sum = 0;
+    for (a = 3; a <= (2 * N); a = next_prime64(a)) {
+    s = prime_sum64(a, N, n, &av);
+    sum += div_frac64(s, av);
+    }
+    return (int)mul_hi64(sum, 1000000000);
+}
+
+/*
+ * Benchmark and verification mode, compile with -DPI_BENCH: computes the
+ * digits at a fixed set of positions, checks them against known digits of
+ * pi and reports the timings. Useful to compare the mul_mod() variants,
+ * HAS_LONG_LONG on/off and the SIMD path, on the host and on RV32.
+ */
+#ifdef PI_BENCH
+
+#include <time.h>
+
+#if defined(__riscv) && (__riscv_xlen == 32)
+/* cycle counter, converted to seconds with the clock frequency */
+#ifndef PI_CPU_FREQ
+#define PI_CPU_FREQ 50000000
+#endif
+#define TICKS_PER_SEC PI_CPU_FREQ
+unsigned long long ticks() {
+    unsigned int lo, hi, hi2;
+    do {
+       asm volatile ("rdcycleh %0" : "=r"(hi));
+       asm volatile ("rdcycle %0"  : "=r"(lo));
+       asm volatile ("rdcycleh %0" : "=r"(hi2));
+    } while(hi != hi2);
+    return ((unsigned long long)hi << 32) | lo;
+}
+#else
+#define TICKS_PER_SEC CLOCKS_PER_SEC
+unsigned long long ticks() {
+    return clock();
+}
+#endif
+
+/* known digits of pi: the 9 decimals starting at position bench_pos[i] */
+const int bench_pos[] = {
+    1, 10, 100, 200, 500, 762, 1000, 2000
+};
+const int bench_digits[] = {
+    141592653, 589793238, 982148086, 644288109,
+    298336733, 999999837, 938095257, 994657640
+};
+#define NB_BENCH ((int)(sizeof(bench_pos) / sizeof(bench_pos[0])))
+
+/* elapsed time in microseconds (no floating point, for small libcs) */
+unsigned long long ticks_to_us(unsigned long long t) {
+    return t * 1000000 / TICKS_PER_SEC;
+}
+
+void bench() {
+    int i, n, D, a, N, nb_primes, errors, lanes;
+    unsigned long long t, us, total_us;
+
+#ifdef HAS_LONG_LONG
+    printf("config: HAS_LONG_LONG");
+#else
+    printf("config: fmod() mul_mod");
+#endif
+#ifdef PI_SIMD
+    lanes = PI_LANES;
+#else
+    lanes = 1;
+#endif
+    printf(", INV_BATCH=%d, SIMD lanes=%d\n", INV_BATCH, lanes);
+
+    errors = 0;
+    total_us = 0;
+    for (i = 0; i < NB_BENCH; i++) {
+       n = bench_pos[i];
+
+       /* number of primes used by digits(n) (not timed) */
+       N = log2_10_mul(n + 20);
+       nb_primes = 0;
+       for (a = 3; a <= (2 * N); a = next_prime(a))
+	  nb_primes++;
+
+       t = ticks();
+       D = digits(n);
+       us = ticks_to_us(ticks() - t);
+       total_us += us;
+
+       printf(
+	  "n=%5d %09d %s %8u us, %5d primes, %6u us/prime\n",
+	  n, D, D == bench_digits[i] ? "OK   " : "ERROR",
+	  (unsigned int)us, nb_primes, (unsigned int)(us / nb_primes)
+       );
+       if (D != bench_digits[i])
+	  errors++;
+    }
+
+    /* digits per second, with 3 decimals */
+    t = total_us ? (9 * NB_BENCH * 1000000000ull) / total_us : 0;
+    printf(
+       "total: %u us, %u.%03u digits/s\n",
+       (unsigned int)total_us, (unsigned int)(t / 1000),
+       (unsigned int)(t % 1000)
+    );
+
+    if (errors) {
+       printf("%d ERROR(S)\n", errors);
+       abort();
+    }
+}
+
+#endif
 
 void main() {
+#ifdef PI_PRIME_CACHE
+    PrimeCache_open(&prime_cache, PI_PRIME_CACHE);
+#endif
+#ifdef PI_BENCH
+    bench();
+    return;
+#endif
+#ifdef PI_POSITION
+    /* compile with -DPI_POSITION=n to get the digits at position n */
+    printf("%09d\n", digits64(PI_POSITION));
+    return;
+#endif
     printf("\npi = 3.");
     for(int n=1; ;n+=9) {
        int D = digits(n);
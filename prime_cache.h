@@ -0,0 +1,199 @@
+/**
+ * prime_cache.h
+ * Persistent prime table, written by sieve.c (./sieve <limit> -o <file>)
+ * and memory-mapped by any program that needs primes, so that they are
+ * not recomputed on every start.
+ *
+ * File format (little endian, version 1):
+ *  - a PrimeCache_header
+ *  - limit/30+1 bytes, one byte per 30 integers: bit i of byte b is set if
+ *    30*b + PrimeCache_wheel[i] is a prime <= limit (2, 3 and 5 are not
+ *    stored, they are the primes that are not on the wheel)
+ */
+
+#ifndef PRIME_CACHE_H
+#define PRIME_CACHE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__) || defined(__APPLE__)
+#define PRIME_CACHE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define PRIME_CACHE_MAGIC   "PRIMES30"
+#define PRIME_CACHE_VERSION 1
+
+typedef struct {
+    char     magic[8];    // PRIME_CACHE_MAGIC
+    uint32_t version;     // PRIME_CACHE_VERSION
+    uint32_t header_size; // sizeof(PrimeCache_header), offset of the bits
+    uint64_t limit;       // all the primes <= limit are in the file
+    uint64_t count;       // number of primes <= limit (including 2,3,5)
+} PrimeCache_header;
+
+typedef struct {
+    const uint8_t* bits;  // one byte per 30 integers
+    uint64_t limit;
+    uint64_t count;
+    void*    data;        // the whole file
+    size_t   size;
+} PrimeCache;
+
+static const uint8_t PrimeCache_wheel[8] = { 1, 7, 11, 13, 17, 19, 23, 29 };
+
+// Bit of residue r mod 30 in a byte, -1 for residues not on the wheel
+static const int8_t PrimeCache_bit[30] = {
+   -1, 0,-1,-1,-1,-1,-1, 1,-1,-1,-1, 2,-1, 3,-1,
+   -1,-1, 4,-1, 5,-1,-1,-1, 6,-1,-1,-1,-1,-1, 7
+};
+
+/**
+ * \brief Initializes the header of a prime cache file
+ * \param[out] H the header
+ * \param[in] limit , count the largest integer and the number of primes
+ */
+static inline void PrimeCache_init_header(
+    PrimeCache_header* H, uint64_t limit, uint64_t count
+) {
+    memset(H, 0, sizeof(PrimeCache_header));
+    memcpy(H->magic, PRIME_CACHE_MAGIC, 8);
+    H->version = PRIME_CACHE_VERSION;
+    H->header_size = sizeof(PrimeCache_header);
+    H->limit = limit;
+    H->count = count;
+}
+
+/**
+ * \brief Opens a prime cache file
+ * \param[out] C the prime cache
+ * \param[in] filename the file written by sieve.c
+ * \retval 1 on success
+ * \retval 0 if the file could not be read or has the wrong format/version
+ * \details The file is memory-mapped when the OS supports it, and read
+ *  otherwise.
+ */
+static inline int PrimeCache_open(PrimeCache* C, const char* filename) {
+    PrimeCache_header* H;
+    memset(C, 0, sizeof(PrimeCache));
+#ifdef PRIME_CACHE_MMAP
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if(fd < 0) {
+	return 0;
+    }
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(PrimeCache_header)) {
+	close(fd);
+	return 0;
+    }
+    C->size = st.st_size;
+    C->data = mmap(NULL, C->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(C->data == MAP_FAILED) {
+	C->data = NULL;
+	return 0;
+    }
+#else
+    FILE* f = fopen(filename, "rb");
+    if(f == NULL) {
+	return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    C->size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    C->data = malloc(C->size);
+    if(
+	C->size < sizeof(PrimeCache_header) ||
+	fread(C->data, 1, C->size, f) != C->size
+    ) {
+	fclose(f);
+	free(C->data);
+	C->data = NULL;
+	return 0;
+    }
+    fclose(f);
+#endif
+    H = (PrimeCache_header*)C->data;
+    if(
+	memcmp(H->magic, PRIME_CACHE_MAGIC, 8) != 0 ||
+	H->version != PRIME_CACHE_VERSION ||
+	C->size < H->header_size + H->limit/30 + 1
+    ) {
+	fprintf(stderr, "%s: not a prime cache (version %d)\n",
+		filename, PRIME_CACHE_VERSION);
+#ifdef PRIME_CACHE_MMAP
+	munmap(C->data, C->size);
+#else
+	free(C->data);
+#endif
+	C->data = NULL;
+	return 0;
+    }
+    C->bits = (const uint8_t*)C->data + H->header_size;
+    C->limit = H->limit;
+    C->count = H->count;
+    return 1;
+}
+
+/**
+ * \brief Closes a prime cache opened by PrimeCache_open()
+ */
+static inline void PrimeCache_close(PrimeCache* C) {
+    if(C->data != NULL) {
+#ifdef PRIME_CACHE_MMAP
+	munmap(C->data, C->size);
+#else
+	free(C->data);
+#endif
+    }
+    memset(C, 0, sizeof(PrimeCache));
+}
+
+/**
+ * \brief Tests whether an integer is prime, in constant time
+ * \param[in] n an integer, n <= C->limit
+ */
+static inline int PrimeCache_is_prime(const PrimeCache* C, uint64_t n) {
+    int bit = PrimeCache_bit[n % 30];
+    if(n < 7) {
+	return n == 2 || n == 3 || n == 5;
+    }
+    return bit >= 0 && (C->bits[n / 30] >> bit) & 1;
+}
+
+/**
+ * \brief Gets the smallest prime larger than n
+ * \return the prime, or 0 if it is larger than C->limit
+ */
+static inline uint64_t PrimeCache_next_prime(const PrimeCache* C, uint64_t n) {
+    if(C->bits == NULL || n >= C->limit) {
+	return 0;
+    }
+    if(n < 5) {
+	uint64_t p = n < 2 ? 2 : (n < 3 ? 3 : 5);
+	return p <= C->limit ? p : 0;
+    }
+    // bits of the residues > n mod 30 in the first byte
+    uint64_t b = n / 30;
+    uint64_t nb_bytes = C->limit / 30 + 1;
+    int i = 0;
+    while(i < 8 && PrimeCache_wheel[i] <= n % 30) {
+	++i;
+    }
+    uint8_t bits = C->bits[b] & (uint8_t)(0xff << i);
+    while(bits == 0) {
+	if(++b >= nb_bytes) {
+	    return 0;
+	}
+	bits = C->bits[b];
+    }
+    return 30*b + PrimeCache_wheel[__builtin_ctz(bits)];
+}
+
+#endif
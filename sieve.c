@@ -1,5 +1,5 @@
 // Taken from picorv32
-// 
+//
 // This is free and unencumbered software released into the public domain.
 //
 // Anyone is free to copy, modify, publish, use, compile, sell, or
@@ -8,81 +8,548 @@
 // means.
 
 // A simple Sieve of Eratosthenes
+// Segmented version: numbers are sieved by cache-sized segments up to a
+// user-given limit (./sieve <limit>), and primes are streamed out as they
+// are found.
+// The segments use a mod-30 wheel: each byte represents 30 integers, one
+// bit for each residue coprime with 30 (1,7,11,13,17,19,23,29), so that
+// multiples of 2, 3 and 5 are neither stored nor visited.
+// On Linux and macOS, segments can be sieved in parallel by worker threads
+// (./sieve <limit> -t <threads>, default is one thread per CPU).
+// Use -q to only print the checksum and the number of primes.
+// Use -c to only count the primes (prime_count(), Lucy's algorithm for large
+// limits), and -V to validate prime_count() against brute force.
+// The primes can be saved to a file (./sieve <limit> -o <file>), that other
+// programs can memory-map to get primes without sieving (see prime_cache.h).
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+
+#if defined(__linux__) || defined(_WIN32) || defined(__APPLE__)
+#define BIGCPU  // we are compiling for a real machine
+#else
+#define TINYCPU // we are compiling for a softcore
+#endif
+
+#ifdef BIGCPU
+#define SIEVE_CACHE // primes can be saved to a file
+#include "prime_cache.h"
+#endif
+
+#if defined(__linux__) || defined(__APPLE__)
+#define SIEVE_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#define MAX_THREADS 64
+#define MAX_SLOTS (2*MAX_THREADS) // segments sieved or waiting to be printed
+#else
+#define MAX_THREADS 1
+#define MAX_SLOTS 1
+#endif
 
-// Note: if this is changed, then checksum need 
+// Note: if this is changed, then checksum need
 // to be updated as well.
 #define BITMAP_SIZE 64
 
+// Default limit: the odd numbers 3 .. 2*BITMAP_SIZE+1 of the original
+// bitmap, for which the checksum is known.
+#define DEFAULT_LIMIT (2*BITMAP_SIZE+1)
+
+// Size of a segment in bytes (30 integers per byte).
+// It should fit in the L1 data cache.
+#ifndef SEGMENT_BYTES
+#ifdef BIGCPU
+#define SEGMENT_BYTES 16384
+#else
+#define SEGMENT_BYTES 256 // softcores have little RAM
+#endif
+#endif
+
 typedef int bool;
 
-static uint32_t bitmap[BITMAP_SIZE/32];
+// A segment covers the integers 30*lo .. 30*(lo+nbytes)-1. Bit b of
+// bitmap[i] is set if 30*(lo+i)+wheel[b] is composite. With threads, the
+// workers sieve the segments and count the primes in them, and the main
+// thread prints them in order.
+typedef struct {
+	uint8_t bitmap[SEGMENT_BYTES];
+	uint64_t lo;
+	uint32_t nbytes;
+	uint32_t count;
+#ifdef SIEVE_THREADS
+	bool done; // sieved, not printed yet
+#endif
+} Segment;
+
+static Segment segments[MAX_SLOTS];
+
+static uint64_t sieve_limit;
+
+static const uint8_t wheel[8] = { 1, 7, 11, 13, 17, 19, 23, 29 };
+
+// Differences between consecutive wheel residues (29 -> 31 for the last)
+static const uint8_t wheel_gap[8] = { 6, 4, 2, 4, 2, 4, 6, 2 };
+
+// Stride tables, for a prime p = 30*pb+wheel[i] and its multiple p*q with
+// q = wheel[j] mod 30:
+// wheel_mask[i][j]: the bit of p*q in its byte
+// wheel_carry[i][j]: the byte of p*(q+wheel_gap[j]) is the one of p*q plus
+//   pb*wheel_gap[j] + wheel_carry[i][j]
+static uint8_t wheel_mask[8][8];
+static uint8_t wheel_carry[8][8];
+
+// Wheel index of the smallest residue >= r coprime with 30, for r < 30
+static uint8_t wheel_next[30];
 
 static uint32_t hash;
 
+// Odd primes p with p*p <= limit, used to sieve the segments
+static uint32_t* base_primes;
+static int nb_base_primes;
+
 static uint32_t mkhash(uint32_t a, uint32_t b)
 {
 	// The XOR version of DJB2
 	return ((a << 5) + a) ^ b;
 }
 
-static void bitmap_set(int idx)
+static void init_wheel(void)
+{
+	uint8_t bit_of[30];
+	for (int i = 0; i < 8; i++)
+		bit_of[wheel[i]] = 1 << i;
+	for (int r = 29, j = 8; r >= 0; r--) {
+		if (j > 0 && wheel[j-1] == r)
+			j--;
+		wheel_next[r] = j;
+	}
+	for (int i = 0; i < 8; i++) {
+		for (int j = 0; j < 8; j++) {
+			int r = (wheel[i]*wheel[j]) % 30;
+			wheel_mask[i][j] = bit_of[r];
+			wheel_carry[i][j] = (r + wheel[i]*wheel_gap[j]) / 30;
+		}
+	}
+}
+
+// Primes are formatted in this buffer, that is output with a single
+// write when it is full (printf() for each prime dominates the run time
+// for large limits)
+#ifdef BIGCPU
+#define OUT_BUF_SIZE 65536
+#else
+#define OUT_BUF_SIZE 256
+#endif
+
+static char out_buf[OUT_BUF_SIZE];
+static uint32_t out_len;
+
+static void out_flush(void)
 {
-   bitmap[idx/32] |= 1 << (idx % 32);
+#if defined(__linux__) || defined(__APPLE__)
+	for (uint32_t done = 0; done < out_len; ) {
+		ssize_t n = write(1, out_buf + done, out_len - done);
+		if (n <= 0)
+			abort();
+		done += n;
+	}
+#else
+	fwrite(out_buf, 1, out_len, stdout);
+#endif
+	out_len = 0;
 }
 
-static bool bitmap_get(int idx)
+static const char digits_lut[201] =
+	"00010203040506070809101112131415161718192021222324"
+	"25262728293031323334353637383940414243444546474849"
+	"50515253545556575859606162636465666768697071727374"
+	"75767778798081828384858687888990919293949596979899";
+
+// Writes n in decimal at p, returns the end. Digits are produced two at a
+// time, with 32-bit divisions once n fits in 32 bits.
+static char* format_u64(char* p, uint64_t n)
 {
-   return (bitmap[idx/32] & (1 << (idx % 32))) != 0;
+	char tmp[20];
+	char* q = tmp + 20;
+	while (n > 0xffffffff) {
+		uint32_t r = n % 100;
+		n /= 100;
+		q -= 2;
+		memcpy(q, digits_lut + 2*r, 2);
+	}
+	uint32_t m = n;
+	while (m >= 100) {
+		uint32_t r = m % 100;
+		m /= 100;
+		q -= 2;
+		memcpy(q, digits_lut + 2*r, 2);
+	}
+	if (m >= 10) {
+		q -= 2;
+		memcpy(q, digits_lut + 2*m, 2);
+	} else {
+		*--q = '0' + m;
+	}
+	memcpy(p, q, tmp + 20 - q);
+	return p + (tmp + 20 - q);
 }
 
-static void print_prime(int idx, int val)
+// With -q, primes are only counted and hashed
+static bool quiet = 0;
+
+static void print_prime(uint64_t idx, uint64_t val)
 {
+	if (quiet) {
+		hash = mkhash(hash, idx);
+		hash = mkhash(hash, val);
+		return;
+	}
+	// a line has at most 1+20+2+8+20+1 chars
+	if (out_len + 64 > OUT_BUF_SIZE)
+		out_flush();
+	char* p = out_buf + out_len;
+
 	if (idx < 10)
-		printf(" ");
-	printf("%d",idx);
+		*p++ = ' ';
+	p = format_u64(p, idx);
 
-	if (idx / 10 == 1)
-		goto force_th;
-	switch (idx % 10) {
-		case 1: printf("st"); break;
-		case 2: printf("nd"); break;
-		case 3: printf("rd"); break;
-	force_th:
-		default: printf("th"); break;
+	const char* suffix = "th";
+	if (idx / 10 != 1) {
+		switch (idx % 10) {
+			case 1: suffix = "st"; break;
+			case 2: suffix = "nd"; break;
+			case 3: suffix = "rd"; break;
+		}
 	}
-	printf(" prime: %d\n",val);
+	*p++ = suffix[0];
+	*p++ = suffix[1];
+	memcpy(p, " prime: ", 8);
+	p = format_u64(p + 8, val);
+	*p++ = '\n';
+	out_len = p - out_buf;
 
 	hash = mkhash(hash, idx);
 	hash = mkhash(hash, val);
 }
 
-void sieve(void)
+// Integer square root
+static uint32_t isqrt(uint64_t n)
 {
+	uint64_t r = 0;
+	for (int b = 31; b >= 0; b--) {
+		uint64_t t = r | (1ull << b);
+		if (t*t <= n)
+			r = t;
+	}
+	return r;
+}
 
-	int idx = 1;
-	hash = 5381;
-	print_prime(idx++, 2);
-	for (int i = 0; i < BITMAP_SIZE; i++) {
-		if (bitmap_get(i))
+// Finds the base primes with a plain sieve of the odd numbers up to
+// sqrt(limit)
+static void init_base_primes(uint64_t limit)
+{
+	uint32_t r = isqrt(limit);
+	char* composite = calloc(r+1, 1);
+	base_primes = malloc((r/2+1)*sizeof(uint32_t));
+	nb_base_primes = 0;
+	for (uint32_t i = 3; i <= r; i += 2) {
+		if (composite[i])
+			continue;
+		base_primes[nb_base_primes++] = i;
+		for (uint64_t j = (uint64_t)i*i; j <= r; j += 2*i)
+			composite[j] = 1;
+	}
+	free(composite);
+}
+
+// Pre-sieving: the multiples of the smallest primes on the wheel are
+// copied from a precomputed tile instead of being crossed off one by one.
+// The pattern of a prime p repeats every p bytes, so the tile for
+// 7, 11 and 13 repeats every 7*11*13 = 1001 bytes. It can be disabled with
+// -P to measure its effect.
+#define PRESIEVE_MAX  13
+#define PRESIEVE_TILE (7*11*13)
+
+static uint8_t presieve_tile[PRESIEVE_TILE];
+static bool presieve = 1;
+
+// Crosses off the multiples of p = 30*pb+wheel[i] in bitmap[0..nbytes-1],
+// starting from byte b and from multiplier q = wheel[j] mod 30
+static void cross_off(
+	uint8_t* bitmap, uint32_t nbytes, uint32_t b, uint32_t pb, int i, int j
+)
+{
+	while (b < nbytes) {
+		bitmap[b] |= wheel_mask[i][j];
+		b += pb*wheel_gap[j] + wheel_carry[i][j];
+		j = (j+1) & 7;
+	}
+}
+
+static void init_presieve(void)
+{
+	// all the multiples of 7, 11, 13 (including themselves), q = 1, 7, ...
+	for (int p = 7; p <= PRESIEVE_MAX; p += 2) {
+		if (p % 3 != 0 && p % 5 != 0)
+			cross_off(presieve_tile, PRESIEVE_TILE, 0, 0, wheel_next[p], 0);
+	}
+}
+
+// Sieves the integers 30*S->lo .. 30*(S->lo+S->nbytes)-1
+static void sieve_segment(Segment* S)
+{
+	uint8_t* bitmap = S->bitmap;
+	uint64_t lo = S->lo;
+	uint32_t nbytes = S->nbytes;
+	uint64_t hi = 30*(lo + nbytes);
+	if (presieve) {
+		uint32_t off = lo % PRESIEVE_TILE;
+		for (uint32_t b = 0; b < nbytes; ) {
+			uint32_t n = PRESIEVE_TILE - off;
+			if (n > nbytes - b)
+				n = nbytes - b;
+			memcpy(bitmap + b, presieve_tile + off, n);
+			b += n;
+			off = 0;
+		}
+		if (lo == 0)
+			bitmap[0] &= ~0x0e; // 7, 11 and 13 are prime
+	} else {
+		memset(bitmap, 0, nbytes);
+	}
+	if (lo == 0)
+		bitmap[0] |= 1; // 1 is not prime
+	for (int k = 0; k < nb_base_primes; k++) {
+		uint64_t p = base_primes[k];
+		if (p < 7 || (presieve && p <= PRESIEVE_MAX))
+			continue; // 3 and 5 are not on the wheel, 7..13 are presieved
+		if (p*p >= hi)
+			break;
+		// first multiple p*q in the segment, with q >= p on the wheel
+		uint64_t q = (30*lo + p - 1) / p;
+		if (q < p)
+			q = p;
+		int j = wheel_next[q % 30];
+		q = q - q % 30 + (j < 8 ? wheel[j] : 31);
+		j &= 7;
+		uint64_t m = p*q;
+		if (m >= hi)
 			continue;
-		print_prime(idx++, 3+2*i);
-		for (int j = 2*(3+2*i);; j += 3+2*i) {
-			if (j%2 == 0)
-				continue;
-			int k = (j-3)/2;
-			if (k >= BITMAP_SIZE)
-				break;
-			bitmap_set(k);
+		cross_off(bitmap, nbytes, m/30 - lo, p/30, wheel_next[p % 30], j);
+	}
+}
+
+// Bits of the primes <= sieve_limit in byte b of a sieved segment
+static uint8_t segment_primes(Segment* S, uint32_t b)
+{
+	uint8_t bits = ~S->bitmap[b];
+	uint64_t base = 30*(S->lo+b);
+	if (base + 29 > sieve_limit) {
+		for (int i = 0; i < 8; i++) {
+			if (base + wheel[i] > sieve_limit)
+				bits &= ~(1 << i);
 		}
 	}
+	return bits;
+}
 
+static uint32_t count_segment(Segment* S)
+{
+	uint32_t count = 0;
+	for (uint32_t b = 0; b < S->nbytes; b++)
+		count += __builtin_popcount(segment_primes(S, b));
+	return count;
+}
+
+static void* sieve_worker(void* arg)
+{
+	Segment* S = arg;
+	sieve_segment(S);
+	S->count = count_segment(S);
+	return NULL;
+}
+
+// Segment k of the bytes 0 .. end-1
+static void init_segment(Segment* S, uint64_t k, uint64_t end)
+{
+	S->lo = k*SEGMENT_BYTES;
+	S->nbytes = end - S->lo < SEGMENT_BYTES ? end - S->lo : SEGMENT_BYTES;
+}
+
+#ifdef SIEVE_THREADS
+// Persistent workers: segment k is sieved in segments[k % nb_slots]. A
+// worker takes the next segment as soon as its slot has been printed, so
+// that sieving overlaps the printing and hashing by the main thread.
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t sieved;  // a segment is done
+	pthread_cond_t printed; // a slot is free
+	uint64_t end;           // bytes to sieve
+	uint64_t nb_segments;
+	uint64_t next;          // next segment to sieve
+	uint64_t nb_printed;    // segments printed by the main thread
+	int nb_slots;
+} pool;
+
+static void* pool_worker(void* arg)
+{
+	(void)arg;
+	pthread_mutex_lock(&pool.lock);
+	for (;;) {
+		while (pool.next < pool.nb_segments &&
+		       pool.next >= pool.nb_printed + pool.nb_slots)
+			pthread_cond_wait(&pool.printed, &pool.lock);
+		if (pool.next >= pool.nb_segments)
+			break;
+		uint64_t k = pool.next++;
+		Segment* S = &segments[k % pool.nb_slots];
+		pthread_mutex_unlock(&pool.lock);
+		init_segment(S, k, pool.end);
+		sieve_worker(S);
+		pthread_mutex_lock(&pool.lock);
+		S->done = 1;
+		pthread_cond_broadcast(&pool.sieved);
+	}
+	pthread_mutex_unlock(&pool.lock);
+	return NULL;
+}
+#endif
+
+// Prints the primes of a sieved segment. This is done in order by the main
+// thread: the index of each prime and the hash depend on all the primes
+// before it.
+static void print_segment(Segment* S, uint64_t* idx)
+{
+	for (uint32_t b = 0; b < S->nbytes; b++) {
+		uint8_t bits = segment_primes(S, b);
+		for (int i = 0; i < 8; i++) {
+			if (bits & (1 << i))
+				print_prime((*idx)++, 30*(S->lo+b) + wheel[i]);
+		}
+	}
+}
+
+#ifdef SIEVE_CACHE
+// Appends the primes of a sieved segment to a prime cache file
+static void write_segment(Segment* S, FILE* f)
+{
+	uint8_t bits[SEGMENT_BYTES];
+	for (uint32_t b = 0; b < S->nbytes; b++)
+		bits[b] = segment_primes(S, b);
+	fwrite(bits, 1, S->nbytes, f);
+}
+#endif
+
+void sieve(uint64_t limit, int nb_threads, const char* cache_file)
+{
+	uint64_t idx = 1;
+	uint64_t count = 0;
+	hash = 5381;
+	sieve_limit = limit;
+	init_base_primes(limit);
+	for (uint64_t p = 2; p <= 5 && p <= limit; p += p-1) {
+		print_prime(idx++, p);
+		count++;
+	}
+	uint64_t end = limit/30 + 1; // bytes needed to reach limit
+#ifdef SIEVE_CACHE
+	PrimeCache_header header;
+	FILE* cache = NULL;
+	if (cache_file != NULL) {
+		cache = fopen(cache_file, "wb");
+		if (cache == NULL) {
+			perror(cache_file);
+			abort();
+		}
+		// count is not known yet, the header is rewritten at the end
+		PrimeCache_init_header(&header, limit, 0);
+		fwrite(&header, sizeof(header), 1, cache);
+	}
+#endif
+	uint64_t nb_segments = (end + SEGMENT_BYTES - 1) / SEGMENT_BYTES;
+	int nb_workers = 0;
+#ifdef SIEVE_THREADS
+	pthread_t workers[MAX_THREADS];
+	if (nb_threads > 1) {
+		pool.end = end;
+		pool.nb_segments = nb_segments;
+		pool.next = 0;
+		pool.nb_printed = 0;
+		pool.nb_slots = 2*nb_threads;
+		pthread_mutex_init(&pool.lock, NULL);
+		pthread_cond_init(&pool.sieved, NULL);
+		pthread_cond_init(&pool.printed, NULL);
+		for (int s = 0; s < pool.nb_slots; s++)
+			segments[s].done = 0;
+		// if no thread can be created, the segments are sieved inline
+		for (int t = 0; t < nb_threads; t++) {
+			if (pthread_create(&workers[nb_workers], NULL,
+					   pool_worker, NULL) == 0)
+				nb_workers++;
+		}
+	}
+#endif
+	// combine the segments in order
+	for (uint64_t k = 0; k < nb_segments; k++) {
+		Segment* S = &segments[0];
+#ifdef SIEVE_THREADS
+		if (nb_workers > 0) {
+			S = &segments[k % pool.nb_slots];
+			pthread_mutex_lock(&pool.lock);
+			while (!S->done)
+				pthread_cond_wait(&pool.sieved, &pool.lock);
+			pthread_mutex_unlock(&pool.lock);
+		}
+#endif
+		if (nb_workers == 0) {
+			init_segment(S, k, end);
+			sieve_worker(S);
+		}
+		print_segment(S, &idx);
+		count += S->count;
+#ifdef SIEVE_CACHE
+		if (cache != NULL)
+			write_segment(S, cache);
+#endif
+#ifdef SIEVE_THREADS
+		if (nb_workers > 0) {
+			pthread_mutex_lock(&pool.lock);
+			S->done = 0;
+			pool.nb_printed++;
+			pthread_cond_broadcast(&pool.printed);
+			pthread_mutex_unlock(&pool.lock);
+		}
+#endif
+	}
+#ifdef SIEVE_THREADS
+	for (int t = 0; t < nb_workers; t++)
+		pthread_join(workers[t], NULL);
+	if (nb_threads > 1) {
+		pthread_mutex_destroy(&pool.lock);
+		pthread_cond_destroy(&pool.sieved);
+		pthread_cond_destroy(&pool.printed);
+	}
+#endif
+	free(base_primes);
+
+#ifdef SIEVE_CACHE
+	if (cache != NULL) {
+		PrimeCache_init_header(&header, limit, count);
+		fseek(cache, 0, SEEK_SET);
+		fwrite(&header, sizeof(header), 1, cache);
+		fclose(cache);
+	}
+#endif
+
+	out_flush();
 	printf("checksum:\n   %x",hash);
 
-	if (hash == 0x1772A48F) {
+	if (limit != DEFAULT_LIMIT) {
+		// no reference checksum for this limit
+		printf(" (%llu primes)\n",(unsigned long long)count);
+	} else if (hash == 0x1772A48F) {
 	        printf(" OK\n");
 	} else {
 		printf(" ERROR\n");
@@ -90,9 +557,147 @@ void sieve(void)
 	}
 }
 
-int main(void)
+// Prime counting: number of primes <= x
+
+// Below this limit, primes are counted with the segmented sieve
+#define PRIME_COUNT_SIEVE_MAX (1 << 20)
+
+static uint64_t prime_count_sieve(uint64_t x)
 {
-   sieve();
-   return 0;
+	uint64_t count = 0;
+	for (uint64_t p = 2; p <= 5 && p <= x; p += p-1)
+		count++;
+	sieve_limit = x;
+	init_base_primes(x);
+	uint64_t end = x/30 + 1;
+	for (uint64_t k = 0; k*SEGMENT_BYTES < end; k++) {
+		Segment* S = &segments[0];
+		init_segment(S, k, end);
+		sieve_worker(S);
+		count += S->count;
+	}
+	free(base_primes);
+	return count;
+}
+
+// Lucy_Hedgehog's algorithm, O(x^(3/4)) time and O(sqrt(x)) memory.
+// S(v) = number of primes <= v is only needed for the values v = x/k.
+// It starts as v-1 (all integers >= 2), and for each prime p <= sqrt(x),
+// the integers whose smallest prime factor is p are removed:
+// S(v) -= S(v/p) - S(p-1), for v >= p*p.
+static uint64_t prime_count_lucy(uint64_t x)
+{
+	uint32_t r = isqrt(x);
+	// small[v] = S(v) for v <= r, large[k] = S(x/k) for k <= r
+	uint64_t* small = malloc((r+1)*sizeof(uint64_t));
+	uint64_t* large = malloc((r+1)*sizeof(uint64_t));
+	for (uint32_t v = 1; v <= r; v++) {
+		small[v] = v-1;
+		large[v] = x/v - 1;
+	}
+	for (uint32_t p = 2; p <= r; p++) {
+		if (small[p] == small[p-1])
+			continue; // p is not prime
+		uint64_t sp = small[p-1];
+		uint64_t p2 = (uint64_t)p*p;
+		uint64_t kmax = x/p2 < r ? x/p2 : r;
+		for (uint64_t k = 1; k <= kmax; k++) {
+			uint64_t d = k*p;
+			large[k] -= (d <= r ? large[d] : small[x/d]) - sp;
+		}
+		for (uint64_t v = r; v >= p2; v--)
+			small[v] -= small[v/p] - sp;
+	}
+	uint64_t count = x < 2 ? 0 : large[1];
+	free(small);
+	free(large);
+	return count;
 }
 
+uint64_t prime_count(uint64_t x)
+{
+	if (x < PRIME_COUNT_SIEVE_MAX)
+		return prime_count_sieve(x);
+	return prime_count_lucy(x);
+}
+
+// Compares both prime counting methods with brute force for small x, and
+// with each other for a few larger x
+#define VALIDATE_MAX 10000
+
+void validate_prime_count(void)
+{
+	static const uint64_t big[] = { 1000000, 10000000, 123456789 };
+	int errors = 0;
+	uint64_t brute = 0;
+	for (uint64_t x = 0; x <= VALIDATE_MAX; x++) {
+		bool prime = x >= 2;
+		for (uint64_t d = 2; d*d <= x && prime; d++)
+			prime = (x % d) != 0;
+		brute += prime;
+		uint64_t s = prime_count_sieve(x);
+		uint64_t l = prime_count_lucy(x);
+		if (s != brute || l != brute) {
+			printf("pi(%llu): brute force %llu, sieve %llu, lucy %llu ERROR\n",
+			       (unsigned long long)x, (unsigned long long)brute,
+			       (unsigned long long)s, (unsigned long long)l);
+			errors++;
+		}
+	}
+	printf("pi(x) for x <= %d: %s\n", VALIDATE_MAX, errors ? "ERROR" : "OK");
+	for (int i = 0; i < (int)(sizeof(big)/sizeof(big[0])); i++) {
+		uint64_t s = prime_count_sieve(big[i]);
+		uint64_t l = prime_count_lucy(big[i]);
+		printf("pi(%llu): sieve %llu, lucy %llu %s\n",
+		       (unsigned long long)big[i], (unsigned long long)s,
+		       (unsigned long long)l, s == l ? "OK" : "ERROR");
+		errors += (s != l);
+	}
+	if (errors)
+		abort();
+}
+
+int main(int argc, char** argv)
+{
+   uint64_t limit = DEFAULT_LIMIT;
+   int nb_threads = 1;
+   const char* cache_file = NULL;
+   bool count = 0;
+   bool validate = 0;
+#ifdef SIEVE_THREADS
+   nb_threads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+#ifdef BIGCPU
+   for (int i = 1; i < argc; i++) {
+      if (!strcmp(argv[i], "-t") && i+1 < argc)
+         nb_threads = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-o") && i+1 < argc)
+         cache_file = argv[++i];
+      else if (!strcmp(argv[i], "-P"))
+         presieve = 0;
+      else if (!strcmp(argv[i], "-q"))
+         quiet = 1;
+      else if (!strcmp(argv[i], "-c"))
+         count = 1;
+      else if (!strcmp(argv[i], "-V"))
+         validate = 1;
+      else
+         limit = strtoull(argv[i], NULL, 0);
+   }
+#endif
+   if (nb_threads < 1)
+      nb_threads = 1;
+   if (nb_threads > MAX_THREADS)
+      nb_threads = MAX_THREADS;
+   init_wheel();
+   init_presieve();
+   if (validate) {
+      validate_prime_count();
+   } else if (count) {
+      printf("pi(%llu) = %llu\n",
+             (unsigned long long)limit, (unsigned long long)prime_count(limit));
+   } else {
+      sieve(limit, nb_threads, cache_file);
+   }
+   return 0;
+}
@@ -4,6 +4,7 @@
 /* Original tinyraytracer: https://github.com/ssloy/tinyraytracer  */
 
 #include <math.h>
+#include <string.h>
 
 
 // It is 80x50 (rather than 80x25) because GL_scan_RGB() and GL_scan_RGBf()
@@ -56,6 +57,10 @@ static inline float vec3_dot(vec3 U, vec3 V) {
   return U.x*V.x+U.y*V.y+U.z*V.z;
 }
 
+static inline vec3 vec3_cross(vec3 U, vec3 V) {
+  return make_vec3(U.y*V.z-U.z*V.y, U.z*V.x-U.x*V.z, U.x*V.y-U.y*V.x);
+}
+
 static inline vec3 vec3_scale(float s, vec3 U) {
   return make_vec3(s*U.x, s*U.y, s*U.z);
 }
@@ -111,25 +116,76 @@ Material make_Material_default() {
 
 /*************************************************************************/
 
+/*
+ * The spheres are stored as a structure of arrays: centers, squared radii
+ * and indices in the materials[] table. The arrays are padded to a multiple
+ * of SPHERES_LANES with spheres of negative squared radius, that no ray
+ * hits, so that they can be tested 8 at a time with AVX2.
+ */
+
+#define MAX_MATERIALS 16
+Material materials[MAX_MATERIALS];
+int nb_materials = 0;
+
+#define SPHERES_LANES 8
+
 typedef struct {
-  vec3 center;
-  float radius;
-  Material material;
-} Sphere;
+  int nb;        // number of spheres
+  int capacity;  // multiple of SPHERES_LANES
+  float* cx;     // centers
+  float* cy;
+  float* cz;
+  float* r2;     // squared radii
+  int* material; // indices in materials[]
+} Spheres;
+
+void Spheres_clear(Spheres* S) {
+  free(S->cx);
+  free(S->cy);
+  free(S->cz);
+  free(S->r2);
+  free(S->material);
+  memset(S, 0, sizeof(Spheres));
+}
+
+void Spheres_add(Spheres* S, vec3 c, float r, int material) {
+  if(S->nb == S->capacity) {
+    int capacity = S->capacity ? 2*S->capacity : SPHERES_LANES;
+    S->cx = realloc(S->cx, sizeof(float) * capacity);
+    S->cy = realloc(S->cy, sizeof(float) * capacity);
+    S->cz = realloc(S->cz, sizeof(float) * capacity);
+    S->r2 = realloc(S->r2, sizeof(float) * capacity);
+    S->material = realloc(S->material, sizeof(int) * capacity);
+    for(int i=S->capacity; i<capacity; ++i) {
+      S->cx[i] = S->cy[i] = S->cz[i] = 0.0f;
+      S->r2[i] = -1.0f; // padding
+      S->material[i] = 0;
+    }
+    S->capacity = capacity;
+  }
+  S->cx[S->nb] = c.x;
+  S->cy[S->nb] = c.y;
+  S->cz[S->nb] = c.z;
+  S->r2[S->nb] = r*r;
+  S->material[S->nb] = material;
+  ++S->nb;
+}
 
-Sphere make_Sphere(vec3 c, float r, Material M) {
-  Sphere S;
-  S.center = c;
-  S.radius = r;
-  S.material = M;
-  return S;
+static inline vec3 Spheres_center(Spheres* S, int i) {
+  return make_vec3(S->cx[i], S->cy[i], S->cz[i]);
 }
 
-BOOL Sphere_ray_intersect(Sphere* S, vec3 orig, vec3 dir, float* t0) {
-  vec3 L = vec3_sub(S->center, orig);
+static inline float Spheres_radius(Spheres* S, int i) {
+  return sqrtf(S->r2[i]);
+}
+
+static inline BOOL Spheres_ray_intersect(
+  Spheres* S, int i, vec3 orig, vec3 dir, float* t0
+) {
+  vec3 L = vec3_sub(Spheres_center(S,i), orig);
   float tca = vec3_dot(L,dir);
   float d2 = vec3_dot(L,L) - tca*tca;
-  float r2 = S->radius*S->radius;
+  float r2 = S->r2[i];
   if (d2 > r2) return 0;
   float thc = sqrtf(r2 - d2);
   *t0       = tca - thc;
@@ -139,6 +195,835 @@ BOOL Sphere_ray_intersect(Sphere* S, vec3 orig, vec3 dir, float* t0) {
   return 1;
 }
 
+/*
+ * Nearest sphere hit by the ray, testing all of them (for hits at the same
+ * distance, the smallest index wins).
+ */
+BOOL Spheres_nearest_scalar(
+  Spheres* S, vec3 orig, vec3 dir, float* dist, int* index
+) {
+  float best = 1e30;
+  int best_index = -1;
+  for(int i=0; i<S->nb; ++i) {
+    float t;
+    if(Spheres_ray_intersect(S, i, orig, dir, &t) && t < best) {
+      best = t;
+      best_index = i;
+    }
+  }
+  *dist = best;
+  *index = best_index;
+  return best_index >= 0;
+}
+
+/*
+ * Same as Spheres_nearest_scalar(). With AVX2 (compile with -mavx2), lane
+ * j tests the spheres j, j+8, j+16 ... with the same operations as
+ * Spheres_ray_intersect(), so that the result is the same, as long as the
+ * compiler does not contract the scalar version into FMAs (with
+ * -march=native, add -ffp-contract=off).
+ */
+BOOL use_simd = 1;
+
+#ifdef __AVX2__
+
+#include <immintrin.h>
+
+BOOL Spheres_nearest(
+  Spheres* S, vec3 orig, vec3 dir, float* dist, int* index
+) {
+  if(!use_simd) {
+    return Spheres_nearest_scalar(S, orig, dir, dist, index);
+  }
+  const __m256 ox = _mm256_set1_ps(orig.x);
+  const __m256 oy = _mm256_set1_ps(orig.y);
+  const __m256 oz = _mm256_set1_ps(orig.z);
+  const __m256 dx = _mm256_set1_ps(dir.x);
+  const __m256 dy = _mm256_set1_ps(dir.y);
+  const __m256 dz = _mm256_set1_ps(dir.z);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256i lane = _mm256_setr_epi32(0,1,2,3,4,5,6,7);
+  __m256 best = _mm256_set1_ps(1e30f);
+  __m256i best_index = _mm256_set1_epi32(-1);
+  for(int i=0; i<S->nb; i+=SPHERES_LANES) {
+    __m256 Lx = _mm256_sub_ps(_mm256_loadu_ps(S->cx+i), ox);
+    __m256 Ly = _mm256_sub_ps(_mm256_loadu_ps(S->cy+i), oy);
+    __m256 Lz = _mm256_sub_ps(_mm256_loadu_ps(S->cz+i), oz);
+    __m256 r2 = _mm256_loadu_ps(S->r2+i);
+    __m256 tca = _mm256_add_ps(
+      _mm256_add_ps(_mm256_mul_ps(Lx,dx), _mm256_mul_ps(Ly,dy)),
+      _mm256_mul_ps(Lz,dz)
+    );
+    __m256 LL = _mm256_add_ps(
+      _mm256_add_ps(_mm256_mul_ps(Lx,Lx), _mm256_mul_ps(Ly,Ly)),
+      _mm256_mul_ps(Lz,Lz)
+    );
+    __m256 d2 = _mm256_sub_ps(LL, _mm256_mul_ps(tca,tca));
+    __m256 hit = _mm256_cmp_ps(d2, r2, _CMP_LE_OQ);
+    if(!_mm256_movemask_ps(hit)) {
+      continue;
+    }
+    __m256 thc = _mm256_sqrt_ps(_mm256_max_ps(_mm256_sub_ps(r2, d2), zero));
+    __m256 t0 = _mm256_sub_ps(tca, thc);
+    __m256 t1 = _mm256_add_ps(tca, thc);
+    __m256 t = _mm256_blendv_ps(t0, t1, _mm256_cmp_ps(t0, zero, _CMP_LT_OQ));
+    hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, zero, _CMP_GE_OQ));
+    hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, best, _CMP_LT_OQ));
+    best = _mm256_blendv_ps(best, t, hit);
+    best_index = _mm256_castps_si256(_mm256_blendv_ps(
+      _mm256_castsi256_ps(best_index),
+      _mm256_castsi256_ps(_mm256_add_epi32(lane, _mm256_set1_epi32(i))),
+      hit
+    ));
+  }
+  float t[SPHERES_LANES];
+  int k[SPHERES_LANES];
+  _mm256_storeu_ps(t, best);
+  _mm256_storeu_si256((__m256i*)k, best_index);
+  *dist = 1e30;
+  *index = -1;
+  for(int l=0; l<SPHERES_LANES; ++l) {
+    if(k[l] >= 0 && (t[l] < *dist || (t[l] == *dist && k[l] < *index))) {
+      *dist = t[l];
+      *index = k[l];
+    }
+  }
+  return *index >= 0;
+}
+
+#else
+
+BOOL Spheres_nearest(
+  Spheres* S, vec3 orig, vec3 dir, float* dist, int* index
+) {
+  return Spheres_nearest_scalar(S, orig, dir, dist, index);
+}
+
+#endif
+
+/*************************************************************************/
+
+/*
+ * Uniform grid, for scenes with many spheres: each cell has the list of
+ * the spheres whose bounding box overlaps it (all the lists are stored in
+ * a single array, cell c has cell_spheres[cell_start[c] .. cell_start[c+1]-1]).
+ * Rays walk through the cells in order (3D-DDA, Amanatides and Woo), and
+ * stop as soon as the nearest hit found so far is before the exit of the
+ * current cell. A sphere that overlaps several cells is only tested once
+ * per ray (mailbox).
+ */
+
+// below GRID_MIN_SPHERES, brute force is faster (with RT_BENCH, the
+// crossover is around 300 spheres with AVX2, 30 in scalar)
+#ifdef __AVX2__
+#define GRID_MIN_SPHERES 256
+#else
+#define GRID_MIN_SPHERES 32
+#endif
+#define GRID_DENSITY     2.0 // number of cells per sphere
+#define GRID_MAX_RES     128 // max number of cells along an axis
+
+typedef struct {
+  Spheres* spheres; // the spheres the grid was built for
+  int nb_spheres;
+  vec3 min, max;    // bounding box
+  vec3 cell_size;
+  int res[3];       // number of cells along each axis
+  int* cell_start;
+  int* cell_spheres;
+  unsigned int* mailbox; // per sphere, the last ray that tested it
+  unsigned int ray_id;
+} Grid;
+
+Grid grid;
+BOOL use_grid = 1;
+int grid_min_spheres = GRID_MIN_SPHERES; // RT_BENCH sets it to 0
+
+static inline float vec3_coord(vec3 V, int axis) {
+  return axis == 0 ? V.x : (axis == 1 ? V.y : V.z);
+}
+
+/* range of cells along axis overlapped by [lo,hi] */
+static void Grid_cell_range(
+  Grid* G, int axis, float lo, float hi, int* c0, int* c1
+) {
+  float m = vec3_coord(G->min, axis);
+  float s = vec3_coord(G->cell_size, axis);
+  *c0 = (int)((lo - m)/s);
+  *c1 = (int)((hi - m)/s);
+  *c0 = *c0 < 0 ? 0 : (*c0 >= G->res[axis] ? G->res[axis]-1 : *c0);
+  *c1 = *c1 < 0 ? 0 : (*c1 >= G->res[axis] ? G->res[axis]-1 : *c1);
+}
+
+void Grid_free(Grid* G) {
+  free(G->cell_start);
+  free(G->cell_spheres);
+  free(G->mailbox);
+  G->cell_start = NULL;
+  G->cell_spheres = NULL;
+  G->mailbox = NULL;
+  G->spheres = NULL;
+  G->nb_spheres = 0;
+}
+
+void Grid_build(Grid* G, Spheres* spheres) {
+  int nb_spheres = spheres->nb;
+  Grid_free(G);
+  if(nb_spheres < grid_min_spheres) {
+    return;
+  }
+  G->spheres = spheres;
+  G->nb_spheres = nb_spheres;
+  G->min = make_vec3( 1e30,  1e30,  1e30);
+  G->max = make_vec3(-1e30, -1e30, -1e30);
+  for(int i=0; i<nb_spheres; ++i) {
+    vec3 c = Spheres_center(spheres, i);
+    float r = Spheres_radius(spheres, i);
+    G->min = make_vec3(
+      min(G->min.x, c.x-r), min(G->min.y, c.y-r), min(G->min.z, c.z-r)
+    );
+    G->max = make_vec3(
+      max(G->max.x, c.x+r), max(G->max.y, c.y+r), max(G->max.z, c.z+r)
+    );
+  }
+  // pad the box, so that hit points computed with rounding errors stay inside
+  G->min = vec3_sub(G->min, make_vec3(1e-3, 1e-3, 1e-3));
+  G->max = vec3_add(G->max, make_vec3(1e-3, 1e-3, 1e-3));
+  vec3 extent = vec3_sub(G->max, G->min);
+  float cell = cbrtf(
+    extent.x * extent.y * extent.z / (GRID_DENSITY * nb_spheres)
+  );
+  int nb_cells = 1;
+  for(int axis=0; axis<3; ++axis) {
+    int n = (int)(vec3_coord(extent, axis) / cell) + 1;
+    G->res[axis] = n > GRID_MAX_RES ? GRID_MAX_RES : n;
+    nb_cells *= G->res[axis];
+  }
+  G->cell_size = make_vec3(
+    extent.x / G->res[0], extent.y / G->res[1], extent.z / G->res[2]
+  );
+  // count the spheres in each cell, then fill the lists
+  G->cell_start = calloc(nb_cells + 1, sizeof(int));
+  for(int pass=0; pass<2; ++pass) {
+    for(int i=0; i<nb_spheres; ++i) {
+      vec3 c = Spheres_center(spheres, i);
+      float r = Spheres_radius(spheres, i);
+      int x0,x1,y0,y1,z0,z1;
+      Grid_cell_range(G, 0, c.x - r, c.x + r, &x0, &x1);
+      Grid_cell_range(G, 1, c.y - r, c.y + r, &y0, &y1);
+      Grid_cell_range(G, 2, c.z - r, c.z + r, &z0, &z1);
+      for(int z=z0; z<=z1; ++z) {
+	for(int y=y0; y<=y1; ++y) {
+	  for(int x=x0; x<=x1; ++x) {
+	    int cell = (z*G->res[1] + y)*G->res[0] + x;
+	    if(pass == 0) {
+	      ++G->cell_start[cell+1];
+	    } else {
+	      G->cell_spheres[G->cell_start[cell]++] = i;
+	    }
+	  }
+	}
+      }
+    }
+    if(pass == 0) {
+      for(int cell=0; cell<nb_cells; ++cell) {
+	G->cell_start[cell+1] += G->cell_start[cell];
+      }
+      G->cell_spheres = malloc(sizeof(int) * (G->cell_start[nb_cells] + 1));
+    } else {
+      // the second pass shifted the starts by one cell
+      for(int cell=nb_cells; cell>0; --cell) {
+	G->cell_start[cell] = G->cell_start[cell-1];
+      }
+      G->cell_start[0] = 0;
+    }
+  }
+  G->mailbox = calloc(nb_spheres, sizeof(unsigned int));
+  G->ray_id = 0;
+}
+
+/*
+ * Nearest sphere hit by the ray (same result as testing all the spheres:
+ * for hits at the same distance, the smallest index wins).
+ */
+BOOL Grid_intersect(
+  Grid* G, vec3 orig, vec3 dir, float* dist, int* index
+) {
+  float o[3] = { orig.x, orig.y, orig.z };
+  float d[3] = { dir.x, dir.y, dir.z };
+  float lo[3] = { G->min.x, G->min.y, G->min.z };
+  float hi[3] = { G->max.x, G->max.y, G->max.z };
+  float size[3] = { G->cell_size.x, G->cell_size.y, G->cell_size.z };
+  float tmin = 0, tmax = 1e30;
+  // clip the ray with the bounding box
+  for(int axis=0; axis<3; ++axis) {
+    if(d[axis] == 0.0f) {
+      if(o[axis] < lo[axis] || o[axis] > hi[axis]) return 0;
+      continue;
+    }
+    float t1 = (lo[axis] - o[axis]) / d[axis];
+    float t2 = (hi[axis] - o[axis]) / d[axis];
+    tmin = max(tmin, min(t1,t2));
+    tmax = min(tmax, max(t1,t2));
+  }
+  if(tmin > tmax) return 0;
+  int cell[3], step[3];
+  float tnext[3], tdelta[3];
+  for(int axis=0; axis<3; ++axis) {
+    float p = o[axis] + tmin * d[axis];
+    cell[axis] = (int)((p - lo[axis]) / size[axis]);
+    if(cell[axis] < 0) cell[axis] = 0;
+    if(cell[axis] >= G->res[axis]) cell[axis] = G->res[axis]-1;
+    if(d[axis] > 0.0f) {
+      step[axis] = 1;
+      tnext[axis] = (lo[axis] + (cell[axis]+1)*size[axis] - o[axis]) / d[axis];
+      tdelta[axis] = size[axis] / d[axis];
+    } else if(d[axis] < 0.0f) {
+      step[axis] = -1;
+      tnext[axis] = (lo[axis] + cell[axis]*size[axis] - o[axis]) / d[axis];
+      tdelta[axis] = -size[axis] / d[axis];
+    } else {
+      step[axis] = 0;
+      tnext[axis] = 1e30;
+      tdelta[axis] = 1e30;
+    }
+  }
+  unsigned int ray_id = ++G->ray_id;
+  float best = 1e30;
+  int best_index = -1;
+  for(;;) {
+    int c = (cell[2]*G->res[1] + cell[1])*G->res[0] + cell[0];
+    for(int k=G->cell_start[c]; k<G->cell_start[c+1]; ++k) {
+      int i = G->cell_spheres[k];
+      float t;
+      if(G->mailbox[i] == ray_id) continue;
+      G->mailbox[i] = ray_id;
+      if(
+	 Spheres_ray_intersect(G->spheres, i, orig, dir, &t) &&
+	 (t < best || (t == best && i < best_index))
+      ) {
+	best = t;
+	best_index = i;
+      }
+    }
+    int axis = tnext[0] < tnext[1] ?
+      (tnext[0] < tnext[2] ? 0 : 2) : (tnext[1] < tnext[2] ? 1 : 2);
+    // hits in the next cells are further away
+    if(best < tnext[axis] || tnext[axis] > tmax) break;
+    cell[axis] += step[axis];
+    if(cell[axis] < 0 || cell[axis] >= G->res[axis]) break;
+    tnext[axis] += tdelta[axis];
+  }
+  *dist = best;
+  *index = best_index;
+  return best_index >= 0;
+}
+
+/*************************************************************************/
+
+/*
+ * Triangle meshes, loaded from OBJ files (./tinyraytracer model.obj): only
+ * the vertices ("v x y z") and the faces ("f i j k ...", with optional
+ * /texture/normal indices, polygons are split into triangles) are read.
+ * On Linux and macOS the file is memory-mapped and parsed in place.
+ *
+ * The triangles are stored in the order of the leaves of a bounding volume
+ * hierarchy, built with the surface area heuristic (binned on the
+ * centroids), and flattened in depth-first order: the left child of an
+ * internal node is the next node, and rays are traversed with a small
+ * stack, nearest child first.
+ */
+
+#if defined(__linux__) || defined(__APPLE__)
+#define RT_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+typedef struct {
+  vec3 v0, e1, e2; // first vertex and edges
+  vec3 N;          // normal
+} Triangle;
+
+typedef struct {
+  vec3 min, max;
+  int first; // internal node: index of the right child, leaf: first triangle
+  int count; // number of triangles, 0 for internal nodes
+} BVHNode;
+
+#define BVH_BINS      12
+#define BVH_LEAF_SIZE 2  // leaves are not split below this size
+#define BVH_STACK     64 // nodes deeper than this are leaves
+#define BVH_MISS      1e30f
+
+typedef struct {
+  int nb_triangles;
+  Triangle* triangles;
+  int nb_nodes;
+  BVHNode* nodes;
+  int depth;    // of the deepest node, at most BVH_STACK
+  int material; // index in materials[]
+} Mesh;
+
+Mesh mesh;
+BOOL use_bvh = 1;
+
+/* Moller-Trumbore */
+static inline BOOL Triangle_ray_intersect(
+  Triangle* T, vec3 orig, vec3 dir, float* t
+) {
+  vec3 p = make_vec3(
+    dir.y*T->e2.z - dir.z*T->e2.y,
+    dir.z*T->e2.x - dir.x*T->e2.z,
+    dir.x*T->e2.y - dir.y*T->e2.x
+  );
+  float det = vec3_dot(T->e1, p);
+  if(fabs(det) < 1e-12) return 0;
+  float inv_det = 1.0f / det;
+  vec3 s = vec3_sub(orig, T->v0);
+  float u = vec3_dot(s, p) * inv_det;
+  if(u < 0.0f || u > 1.0f) return 0;
+  vec3 q = make_vec3(
+    s.y*T->e1.z - s.z*T->e1.y,
+    s.z*T->e1.x - s.x*T->e1.z,
+    s.x*T->e1.y - s.y*T->e1.x
+  );
+  float v = vec3_dot(dir, q) * inv_det;
+  if(v < 0.0f || u + v > 1.0f) return 0;
+  *t = vec3_dot(T->e2, q) * inv_det;
+  return *t > 0.0f;
+}
+
+/************************* OBJ parser *************************************/
+
+static inline BOOL obj_space(char c) {
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+static const char* obj_skip_space(const char* p, const char* end) {
+  while(p < end && obj_space(*p)) ++p;
+  return p;
+}
+
+static const char* obj_next_line(const char* p, const char* end) {
+  while(p < end && *p != '\n') ++p;
+  return p < end ? p+1 : p;
+}
+
+/* the file is not zero-terminated, so strtof() and atoi() cannot be used */
+static const char* obj_parse_int(const char* p, const char* end, int* x) {
+  int sign = 1;
+  *x = 0;
+  if(p < end && (*p == '-' || *p == '+')) {
+    sign = (*p == '-') ? -1 : 1;
+    ++p;
+  }
+  while(p < end && *p >= '0' && *p <= '9') {
+    *x = 10 * *x + (*p - '0');
+    ++p;
+  }
+  *x *= sign;
+  return p;
+}
+
+static const char* obj_parse_float(const char* p, const char* end, float* x) {
+  double sign = 1.0, value = 0.0, scale = 1.0;
+  if(p < end && (*p == '-' || *p == '+')) {
+    sign = (*p == '-') ? -1.0 : 1.0;
+    ++p;
+  }
+  while(p < end && *p >= '0' && *p <= '9') {
+    value = 10.0 * value + (*p - '0');
+    ++p;
+  }
+  if(p < end && *p == '.') {
+    ++p;
+    while(p < end && *p >= '0' && *p <= '9') {
+      scale *= 0.1;
+      value += (*p - '0') * scale;
+      ++p;
+    }
+  }
+  if(p < end && (*p == 'e' || *p == 'E')) {
+    int e;
+    p = obj_parse_int(p+1, end, &e);
+    value *= pow(10.0, e);
+  }
+  *x = (float)(sign * value);
+  return p;
+}
+
+/*
+ * Reads the vertices and triangles of the OBJ file in [p,end). Called a
+ * first time with vertices = NULL to count them.
+ */
+static void obj_parse(
+  const char* p, const char* end, vec3* vertices, int* triangles,
+  int* nb_vertices, int* nb_triangles
+) {
+  *nb_vertices = 0;
+  *nb_triangles = 0;
+  while(p < end) {
+    p = obj_skip_space(p, end);
+    if(end - p > 1 && p[0] == 'v' && obj_space(p[1])) {
+      float xyz[3];
+      for(int i=0; i<3; ++i) {
+	p = obj_parse_float(obj_skip_space(p+(i==0), end), end, &xyz[i]);
+      }
+      if(vertices != NULL) {
+	vertices[*nb_vertices] = make_vec3(xyz[0], xyz[1], xyz[2]);
+      }
+      ++*nb_vertices;
+    } else if(end - p > 1 && p[0] == 'f' && obj_space(p[1])) {
+      int first = 0, prev = 0, n = 0;
+      ++p;
+      for(;;) {
+	int v;
+	p = obj_skip_space(p, end);
+	if(p == end || *p < '+' || *p > '9') break;
+	p = obj_parse_int(p, end, &v);
+	while(p < end && !obj_space(*p) && *p != '\n') ++p; // /vt/vn
+	v = v < 0 ? *nb_vertices + v : v - 1;
+	if(n >= 2) {
+	  if(triangles != NULL) {
+	    int* T = triangles + 3 * *nb_triangles;
+	    T[0] = first;
+	    T[1] = prev;
+	    T[2] = v;
+	  }
+	  ++*nb_triangles;
+	}
+	if(n == 0) first = v;
+	prev = v;
+	++n;
+      }
+    }
+    p = obj_next_line(p, end);
+  }
+}
+
+/******************************* BVH **************************************/
+
+static inline vec3 vec3_min(vec3 U, vec3 V) {
+  return make_vec3(min(U.x,V.x), min(U.y,V.y), min(U.z,V.z));
+}
+
+static inline vec3 vec3_max(vec3 U, vec3 V) {
+  return make_vec3(max(U.x,V.x), max(U.y,V.y), max(U.z,V.z));
+}
+
+static inline float box_area(vec3 lo, vec3 hi) {
+  vec3 e = vec3_sub(hi, lo);
+  if(e.x < 0.0f) return 0.0f;
+  return 2.0f * (e.x*e.y + e.y*e.z + e.z*e.x);
+}
+
+static void Triangle_bounds(Triangle* T, vec3* lo, vec3* hi) {
+  vec3 v1 = vec3_add(T->v0, T->e1);
+  vec3 v2 = vec3_add(T->v0, T->e2);
+  *lo = vec3_min(T->v0, vec3_min(v1, v2));
+  *hi = vec3_max(T->v0, vec3_max(v1, v2));
+}
+
+static vec3 Triangle_centroid(Triangle* T) {
+  return vec3_add(T->v0, vec3_scale(1.0f/3.0f, vec3_add(T->e1, T->e2)));
+}
+
+/*
+ * builds the subtree of the triangles [first, first+count), returns its root
+ * (depth is the one of the root, so that traversal never needs more than
+ * BVH_STACK entries)
+ */
+static int BVH_build_node(Mesh* M, int first, int count, int depth) {
+  int node = M->nb_nodes++;
+  M->depth = depth > M->depth ? depth : M->depth;
+  BVHNode* N = &M->nodes[node];
+  vec3 clo = make_vec3( 1e30,  1e30,  1e30);
+  vec3 chi = make_vec3(-1e30, -1e30, -1e30);
+  N->min = clo;
+  N->max = chi;
+  for(int i=first; i<first+count; ++i) {
+    vec3 lo, hi, c = Triangle_centroid(&M->triangles[i]);
+    Triangle_bounds(&M->triangles[i], &lo, &hi);
+    N->min = vec3_min(N->min, lo);
+    N->max = vec3_max(N->max, hi);
+    clo = vec3_min(clo, c);
+    chi = vec3_max(chi, c);
+  }
+  // pad the box, so that rays that graze a triangle do not miss its box
+  vec3 pad = vec3_scale(1e-5f, vec3_sub(N->max, N->min));
+  pad = vec3_add(pad, make_vec3(1e-6f, 1e-6f, 1e-6f));
+  N->min = vec3_sub(N->min, pad);
+  N->max = vec3_add(N->max, pad);
+  N->first = first;
+  N->count = count;
+  if(count <= BVH_LEAF_SIZE || depth >= BVH_STACK) {
+    return node;
+  }
+  // SAH: the cost of a split is area(left)*count(left)+area(right)*count(right)
+  float best_cost = box_area(N->min, N->max) * count;
+  int best_axis = -1, best_bin = 0;
+  for(int axis=0; axis<3; ++axis) {
+    float lo = vec3_coord(clo, axis), hi = vec3_coord(chi, axis);
+    if(hi - lo < 1e-12f) continue;
+    int bin_count[BVH_BINS] = { 0 };
+    vec3 bin_min[BVH_BINS], bin_max[BVH_BINS];
+    for(int b=0; b<BVH_BINS; ++b) {
+      bin_min[b] = make_vec3( 1e30,  1e30,  1e30);
+      bin_max[b] = make_vec3(-1e30, -1e30, -1e30);
+    }
+    for(int i=first; i<first+count; ++i) {
+      vec3 tlo, thi;
+      float c = vec3_coord(Triangle_centroid(&M->triangles[i]), axis);
+      int b = (int)(BVH_BINS * (c - lo) / (hi - lo));
+      b = b >= BVH_BINS ? BVH_BINS-1 : b;
+      Triangle_bounds(&M->triangles[i], &tlo, &thi);
+      ++bin_count[b];
+      bin_min[b] = vec3_min(bin_min[b], tlo);
+      bin_max[b] = vec3_max(bin_max[b], thi);
+    }
+    // sweep from the right, then from the left
+    float right_cost[BVH_BINS];
+    vec3 rlo = make_vec3( 1e30,  1e30,  1e30);
+    vec3 rhi = make_vec3(-1e30, -1e30, -1e30);
+    int rn = 0;
+    for(int b=BVH_BINS-1; b>0; --b) {
+      rlo = vec3_min(rlo, bin_min[b]);
+      rhi = vec3_max(rhi, bin_max[b]);
+      rn += bin_count[b];
+      right_cost[b] = box_area(rlo, rhi) * rn;
+    }
+    vec3 llo = make_vec3( 1e30,  1e30,  1e30);
+    vec3 lhi = make_vec3(-1e30, -1e30, -1e30);
+    int ln = 0;
+    for(int b=0; b<BVH_BINS-1; ++b) {
+      llo = vec3_min(llo, bin_min[b]);
+      lhi = vec3_max(lhi, bin_max[b]);
+      ln += bin_count[b];
+      float cost = box_area(llo, lhi) * ln + right_cost[b+1];
+      if(ln > 0 && ln < count && cost < best_cost) {
+	best_cost = cost;
+	best_axis = axis;
+	best_bin = b;
+      }
+    }
+  }
+  if(best_axis < 0) {
+    return node; // no split is better than a leaf
+  }
+  // partition: triangles in bins <= best_bin go to the left
+  float lo = vec3_coord(clo, best_axis), hi = vec3_coord(chi, best_axis);
+  int i = first, j = first + count - 1;
+  while(i <= j) {
+    float c = vec3_coord(Triangle_centroid(&M->triangles[i]), best_axis);
+    int b = (int)(BVH_BINS * (c - lo) / (hi - lo));
+    b = b >= BVH_BINS ? BVH_BINS-1 : b;
+    if(b <= best_bin) {
+      ++i;
+    } else {
+      Triangle tmp = M->triangles[i];
+      M->triangles[i] = M->triangles[j];
+      M->triangles[j] = tmp;
+      --j;
+    }
+  }
+  int left_count = i - first;
+  BVH_build_node(M, first, left_count, depth+1); // left child is node+1
+  int right = BVH_build_node(M, i, count - left_count, depth+1);
+  N = &M->nodes[node];
+  N->first = right;
+  N->count = 0;
+  return node;
+}
+
+void BVH_build(Mesh* M) {
+  free(M->nodes);
+  M->nodes = malloc(sizeof(BVHNode) * (2 * M->nb_triangles + 1));
+  M->nb_nodes = 0;
+  M->depth = 0;
+  if(M->nb_triangles > 0) {
+    BVH_build_node(M, 0, M->nb_triangles, 0);
+  }
+}
+
+/* distance where the ray enters the box, or BVH_MISS if it misses it */
+static inline float BVHNode_ray_enter(
+  BVHNode* N, vec3 orig, vec3 inv_dir, float tmax
+) {
+  float tx1 = (N->min.x - orig.x) * inv_dir.x;
+  float tx2 = (N->max.x - orig.x) * inv_dir.x;
+  float ty1 = (N->min.y - orig.y) * inv_dir.y;
+  float ty2 = (N->max.y - orig.y) * inv_dir.y;
+  float tz1 = (N->min.z - orig.z) * inv_dir.z;
+  float tz2 = (N->max.z - orig.z) * inv_dir.z;
+  float t0 = max(max(min(tx1,tx2), min(ty1,ty2)), max(min(tz1,tz2), 0.0f));
+  float t1 = min(min(max(tx1,tx2), max(ty1,ty2)), min(max(tz1,tz2), tmax));
+  return t0 <= t1 ? t0 : BVH_MISS;
+}
+
+/*
+ * Nearest triangle hit by the ray before tmax (for hits at the same
+ * distance, the smallest index wins, as when testing all the triangles).
+ */
+BOOL Mesh_intersect(
+  Mesh* M, vec3 orig, vec3 dir, float tmax, float* dist, int* index
+) {
+  float best = tmax;
+  int best_index = -1;
+  if(!use_bvh) {
+    for(int i=0; i<M->nb_triangles; ++i) {
+      float t;
+      if(Triangle_ray_intersect(&M->triangles[i], orig, dir, &t) && t < best) {
+	best = t;
+	best_index = i;
+      }
+    }
+  } else if(M->nb_nodes > 0) {
+    vec3 inv_dir = make_vec3(1.0f/dir.x, 1.0f/dir.y, 1.0f/dir.z);
+    int stack[BVH_STACK];
+    int sp = 0;
+    int node = 0;
+    if(BVHNode_ray_enter(&M->nodes[0], orig, inv_dir, best) == BVH_MISS) {
+      return 0;
+    }
+    for(;;) {
+      BVHNode* N = &M->nodes[node];
+      if(N->count > 0) {
+	for(int i=N->first; i<N->first+N->count; ++i) {
+	  float t;
+	  if(
+	    Triangle_ray_intersect(&M->triangles[i], orig, dir, &t) &&
+	    (t < best || (t == best && i < best_index))
+	  ) {
+	    best = t;
+	    best_index = i;
+	  }
+	}
+      } else {
+	int child0 = node+1, child1 = N->first;
+	float t0 = BVHNode_ray_enter(&M->nodes[child0], orig, inv_dir, best);
+	float t1 = BVHNode_ray_enter(&M->nodes[child1], orig, inv_dir, best);
+	if(t1 < t0) { // visit the nearest child first
+	  int tmp = child0; child0 = child1; child1 = tmp;
+	  float ftmp = t0; t0 = t1; t1 = ftmp;
+	}
+	if(t0 != BVH_MISS) {
+	  if(t1 != BVH_MISS) { // sp <= depth of node < BVH_STACK
+	    stack[sp++] = child1;
+	  }
+	  node = child0;
+	  continue;
+	}
+      }
+      if(sp == 0) break;
+      node = stack[--sp];
+    }
+  }
+  *dist = best;
+  *index = best_index;
+  return best_index >= 0;
+}
+
+/*
+ * Loads an OBJ file, scales and translates it so that it fits in a cube of
+ * the given size centered on center, and builds its BVH.
+ */
+BOOL Mesh_load(Mesh* M, const char* filename, vec3 center, float size) {
+  const char* data;
+  size_t data_size;
+#ifdef RT_MMAP
+  int fd = open(filename, O_RDONLY);
+  struct stat st;
+  if(fd < 0) {
+    return 0;
+  }
+  if(fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return 0;
+  }
+  data_size = st.st_size;
+  data = mmap(NULL, data_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED) {
+    return 0;
+  }
+#else
+  FILE* f = fopen(filename, "rb");
+  if(f == NULL) {
+    return 0;
+  }
+  fseek(f, 0, SEEK_END);
+  data_size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  data = malloc(data_size);
+  if(fread((char*)data, 1, data_size, f) != data_size) {
+    fclose(f);
+    free((char*)data);
+    return 0;
+  }
+  fclose(f);
+#endif
+  int nb_vertices, nb_triangles;
+  obj_parse(data, data+data_size, NULL, NULL, &nb_vertices, &nb_triangles);
+  vec3* vertices = malloc(sizeof(vec3) * (nb_vertices + 1));
+  int* triangles = malloc(sizeof(int) * 3 * (nb_triangles + 1));
+  obj_parse(
+    data, data+data_size, vertices, triangles, &nb_vertices, &nb_triangles
+  );
+#ifdef RT_MMAP
+  munmap((void*)data, data_size);
+#else
+  free((char*)data);
+#endif
+  vec3 lo = make_vec3( 1e30,  1e30,  1e30);
+  vec3 hi = make_vec3(-1e30, -1e30, -1e30);
+  for(int i=0; i<nb_vertices; ++i) {
+    lo = vec3_min(lo, vertices[i]);
+    hi = vec3_max(hi, vertices[i]);
+  }
+  vec3 extent = vec3_sub(hi, lo);
+  float s = size / max(max(extent.x, extent.y), max(extent.z, 1e-12f));
+  vec3 mid = vec3_scale(0.5f, vec3_add(lo, hi));
+  for(int i=0; i<nb_vertices; ++i) {
+    vertices[i] = vec3_add(center, vec3_scale(s, vec3_sub(vertices[i], mid)));
+  }
+  free(M->triangles);
+  M->triangles = malloc(sizeof(Triangle) * (nb_triangles + 1));
+  M->nb_triangles = 0;
+  for(int i=0; i<nb_triangles; ++i) {
+    int* T = triangles + 3*i;
+    if(
+      T[0] < 0 || T[0] >= nb_vertices ||
+      T[1] < 0 || T[1] >= nb_vertices ||
+      T[2] < 0 || T[2] >= nb_vertices
+    ) {
+      continue; // invalid index
+    }
+    Triangle* tri = &M->triangles[M->nb_triangles];
+    tri->v0 = vertices[T[0]];
+    tri->e1 = vec3_sub(vertices[T[1]], tri->v0);
+    tri->e2 = vec3_sub(vertices[T[2]], tri->v0);
+    vec3 n = make_vec3(
+      tri->e1.y*tri->e2.z - tri->e1.z*tri->e2.y,
+      tri->e1.z*tri->e2.x - tri->e1.x*tri->e2.z,
+      tri->e1.x*tri->e2.y - tri->e1.y*tri->e2.x
+    );
+    if(vec3_length(n) == 0.0f) {
+      continue; // degenerate
+    }
+    tri->N = vec3_normalize(n);
+    ++M->nb_triangles;
+  }
+  free(vertices);
+  free(triangles);
+  BVH_build(M);
+  return M->nb_triangles > 0;
+}
+
+/*************************************************************************/
+
 vec3 reflect(vec3 I, vec3 N) {
   return vec3_sub(I, vec3_scale(2.f*vec3_dot(I,N),N));
 }
@@ -156,21 +1041,56 @@ vec3 refract(vec3 I, vec3 N, float eta_t, float eta_i /* =1.f */) {
               : vec3_add(vec3_scale(eta,I),vec3_scale((eta*cosi - sqrtf(k)),N));
 }
 
+#ifdef RT_BENCH
+long long nb_rays = 0; // number of calls to scene_intersect()
+#endif
+
+BOOL scene_intersect_after_spheres(
+   vec3 orig, vec3 dir, Spheres* spheres,
+   BOOL sphere_hit, float spheres_dist, int i,
+   vec3* hit, vec3* N, Material* material
+);
+
 BOOL scene_intersect(
-   vec3 orig, vec3 dir, Sphere* spheres, int nb_spheres,
+   vec3 orig, vec3 dir, Spheres* spheres,
    vec3* hit, vec3* N, Material* material
 ) {
   float spheres_dist = 1e30;
-  for(int i=0; i<nb_spheres; ++i) {
-    float dist_i;
-    if(
-       Sphere_ray_intersect(&spheres[i], orig, dir, &dist_i) &&
-       (dist_i < spheres_dist)
-    ) {
-      spheres_dist = dist_i;
-      *hit = vec3_add(orig,vec3_scale(dist_i,dir));
-      *N = vec3_normalize(vec3_sub(*hit, spheres[i].center));
-      *material = spheres[i].material;
+#ifdef RT_BENCH
+  ++nb_rays;
+#endif
+  int i;
+  BOOL sphere_hit =
+    (use_grid && grid.spheres == spheres && grid.nb_spheres == spheres->nb)
+      ? Grid_intersect(&grid, orig, dir, &spheres_dist, &i)
+      : Spheres_nearest(spheres, orig, dir, &spheres_dist, &i);
+  return scene_intersect_after_spheres(
+    orig, dir, spheres, sphere_hit, spheres_dist, i, hit, N, material
+  );
+}
+
+/*
+ * Second part of scene_intersect(), once the nearest sphere is known (i, at
+ * distance spheres_dist, if sphere_hit): the mesh and the checkerboard.
+ */
+BOOL scene_intersect_after_spheres(
+   vec3 orig, vec3 dir, Spheres* spheres,
+   BOOL sphere_hit, float spheres_dist, int i,
+   vec3* hit, vec3* N, Material* material
+) {
+  if(sphere_hit) {
+    *hit = vec3_add(orig,vec3_scale(spheres_dist,dir));
+    *N = vec3_normalize(vec3_sub(*hit, Spheres_center(spheres, i)));
+    *material = materials[spheres->material[i]];
+  }
+  if(mesh.nb_triangles > 0) {
+    float mesh_dist;
+    int i;
+    if(Mesh_intersect(&mesh, orig, dir, spheres_dist, &mesh_dist, &i)) {
+      spheres_dist = mesh_dist;
+      *hit = vec3_add(orig,vec3_scale(mesh_dist,dir));
+      *N = mesh.triangles[i].N;
+      *material = materials[mesh.material];
     }
   }
   float checkerboard_dist = 1e30;
@@ -190,23 +1110,39 @@ BOOL scene_intersect(
   return min(spheres_dist, checkerboard_dist)<1000;
 }
 
+vec3 background(vec3 dir) {
+    float s = 0.5*(dir.y + 1.0);
+    return vec3_add(
+	vec3_scale(s,make_vec3(0.2, 0.7, 0.8)),
+        vec3_scale(s,make_vec3(0.0, 0.0, 0.5))
+    );
+}
+
+vec3 shade(
+   vec3 dir, vec3 point, vec3 N, Material material,
+   Spheres* spheres, Light* lights, int nb_lights, int depth
+);
+
 vec3 cast_ray(
-   vec3 orig, vec3 dir, Sphere* spheres, int nb_spheres,
+   vec3 orig, vec3 dir, Spheres* spheres,
    Light* lights, int nb_lights, int depth /* =0 */
 ) {
   vec3 point,N;
   Material material = make_Material_default();
   if (
     depth>2 ||
-    !scene_intersect(orig, dir, spheres, nb_spheres, &point, &N, &material)
+    !scene_intersect(orig, dir, spheres, &point, &N, &material)
   ) {
-    float s = 0.5*(dir.y + 1.0);
-    return vec3_add(
-	vec3_scale(s,make_vec3(0.2, 0.7, 0.8)),
-        vec3_scale(s,make_vec3(0.0, 0.0, 0.5))
-    );
+    return background(dir);
   }
+  return shade(dir, point, N, material, spheres, lights, nb_lights, depth);
+}
 
+/* color of the point hit by the ray, with the reflected and refracted rays */
+vec3 shade(
+   vec3 dir, vec3 point, vec3 N, Material material,
+   Spheres* spheres, Light* lights, int nb_lights, int depth
+) {
   vec3 reflect_dir=vec3_normalize(reflect(dir, N));
   vec3 refract_dir=vec3_normalize(refract(dir,N,material.refractive_index,1));
   
@@ -220,11 +1156,11 @@ vec3 cast_ray(
                ? vec3_sub(point,vec3_scale(1e-3,N))
                : vec3_add(point,vec3_scale(1e-3,N));
   vec3 reflect_color = cast_ray(
-       reflect_orig, reflect_dir, spheres, nb_spheres,
+       reflect_orig, reflect_dir, spheres,
        lights, nb_lights, depth + 1
   );
   vec3 refract_color = cast_ray(
-       refract_orig, refract_dir, spheres, nb_spheres,
+       refract_orig, refract_dir, spheres,
        lights, nb_lights, depth + 1
   );
   
@@ -242,7 +1178,7 @@ vec3 cast_ray(
     Material tmpmaterial;
     if (
        scene_intersect(
-	 shadow_orig, light_dir, spheres, nb_spheres,
+	 shadow_orig, light_dir, spheres,
 	 &shadow_pt, &shadow_N, &tmpmaterial
        ) && (
   	 vec3_length(vec3_sub(shadow_pt,shadow_orig)) < light_distance
@@ -273,56 +1209,497 @@ vec3 cast_ray(
 }
 
 
-int nb_spheres = 4;
-Sphere spheres[4];
+Spheres spheres;
 
 int nb_lights = 3;
 Light lights[3];
 
+/* pseudo-random number in [0,1], for the stress scenes */
+static unsigned int random_seed = 12345;
+static inline float random_float() {
+  random_seed = random_seed * 1103515245u + 12345u;
+  return (float)(random_seed >> 8) / (float)(1u << 24);
+}
+
+/*
+ * Replaces the spheres with n random ones, in the box [-12,12]x[-4,10]x
+ * [-40,-10], with a radius that keeps the density of the default scene.
+ */
+void init_stress_scene(int n) {
+  Spheres_clear(&spheres);
+  random_seed = 12345;
+  float r = 2.0f * cbrtf(4.0f / (float)n);
+  for(int i=0; i<n; ++i) {
+    vec3 c = make_vec3(
+      -12.0f + 24.0f * random_float(),
+      -4.0f  + 14.0f * random_float(),
+      -40.0f + 30.0f * random_float()
+    );
+    float ri = r * (0.5f + 0.5f * random_float());
+    Spheres_add(&spheres, c, ri, (int)(4.0f * random_float()) & 3);
+  }
+  Grid_build(&grid, &spheres);
+}
+
 void init_scene() {
-    Material ivory = make_Material(
+    enum { ivory, glass, red_rubber, mirror };
+    materials[ivory] = make_Material(
        1.0, make_vec4(0.6,  0.3, 0.1, 0.0), make_vec3(0.4, 0.4, 0.3),   50.
     );
-    Material glass = make_Material(
+    materials[glass] = make_Material(
        1.5, make_vec4(0.0,  0.5, 0.1, 0.8), make_vec3(0.6, 0.7, 0.8),  125.
     );
-    Material red_rubber = make_Material(
+    materials[red_rubber] = make_Material(
        1.0, make_vec4(0.9,  0.1, 0.0, 0.0), make_vec3(0.3, 0.1, 0.1),   10.
     );
-    Material mirror = make_Material(
+    materials[mirror] = make_Material(
        1.0, make_vec4(0.0, 10.0, 0.8, 0.0), make_vec3(1.0, 1.0, 1.0),  142.
     );
+    nb_materials = 4;
 
-    spheres[0] = make_Sphere(make_vec3(-3,    0,   -16), 2,      ivory);
-    spheres[1] = make_Sphere(make_vec3(-1.0, -1.5, -12), 2,      glass);
-    spheres[2] = make_Sphere(make_vec3( 1.5, -0.5, -18), 3, red_rubber);
-    spheres[3] = make_Sphere(make_vec3( 7,    5,   -18), 4,     mirror);
+    Spheres_clear(&spheres);
+    Spheres_add(&spheres, make_vec3(-3,    0,   -16), 2,      ivory);
+    Spheres_add(&spheres, make_vec3(-1.0, -1.5, -12), 2,      glass);
+    Spheres_add(&spheres, make_vec3( 1.5, -0.5, -18), 3, red_rubber);
+    Spheres_add(&spheres, make_vec3( 7,    5,   -18), 4,     mirror);
 
     lights[0] = make_Light(make_vec3(-20, 20,  20), 1.5);
     lights[1] = make_Light(make_vec3( 30, 50, -25), 1.8);
     lights[2] = make_Light(make_vec3( 30, 20,  30), 1.7);
+
+    // compile with -DRT_STRESS=n for a scene with n random spheres
+#ifdef RT_STRESS
+    init_stress_scene(RT_STRESS);
+#endif
+    Grid_build(&grid, &spheres);
 }
 
 
-void render(int x, int y, float* r, float* g, float* b) {
+/* direction of the primary ray through pixel (x,y) of a width x height image */
+vec3 primary_dir(int x, int y, int width, int height) {
    const float fov  = M_PI/3.;
-   float dir_x =  (x + 0.5) - GL_width/2.;
-   float dir_y = -(y + 0.5) + GL_height/2.; // this flips the image.
-   float dir_z = -GL_height/(2.*tan(fov/2.));
-   vec3 C = cast_ray(
-       make_vec3(0,0,0), vec3_normalize(make_vec3(dir_x, dir_y, dir_z)),
-       spheres, nb_spheres, lights, nb_lights, 0
+   float dir_x =  (x + 0.5) - width/2.;
+   float dir_y = -(y + 0.5) + height/2.; // this flips the image.
+   float dir_z = -height/(2.*tan(fov/2.));
+   return vec3_normalize(make_vec3(dir_x, dir_y, dir_z));
+}
+
+/* color of pixel (x,y) of a width x height image */
+vec3 trace_pixel(int x, int y, int width, int height) {
+   return cast_ray(
+       make_vec3(0,0,0), primary_dir(x, y, width, height),
+       &spheres, lights, nb_lights, 0
    );
-   *r=C.x;
-   *g=C.y;
-   *b=C.z;
 }
 
+/*
+ * Packets of 2x2 primary rays: the spheres are culled once for the four
+ * rays, against the frustum formed by the four rays (a pyramid with its
+ * apex at the eye, bounded by the planes through adjacent rays), then the
+ * remaining ones are tested with the four rays at once (in SIMD with
+ * -mavx2). Only the spheres are done per packet: the mesh, the checkerboard
+ * and the secondary rays (reflection, refraction, shadows), that are no
+ * longer coherent, are traced one ray at a time. The result is the same as
+ * with trace_pixel(). With the grid, each ray walks its own cells, so
+ * packets just call trace_pixel(). The grid is only built from
+ * GRID_MIN_SPHERES spheres, below which brute force (and packets) is
+ * faster: packets are used up to 255 spheres with AVX2, 31 in scalar.
+ */
+BOOL use_packets = 1;
+
+#define PACKET_CULL_EPS 1e-3f // margin for the rounding errors of the culling
+
+int* packet_candidates = NULL;  // the spheres that overlap the frustum
+int packet_candidates_capacity = 0;
+
+/* gets the spheres that overlap the frustum of the 4 rays (in order) */
+int packet_cull(Spheres* S, vec3 orig, vec3* dir) {
+  static const int corner[4] = { 0, 1, 3, 2 }; // around the frustum
+  vec3 center = vec3_add(vec3_add(dir[0],dir[1]),vec3_add(dir[2],dir[3]));
+  vec3 N[4];
+  for(int k=0; k<4; ++k) {
+    N[k] = vec3_normalize(
+      vec3_cross(dir[corner[k]], dir[corner[(k+1)%4]])
+    );
+    if(vec3_dot(N[k], center) < 0) {
+      N[k] = vec3_neg(N[k]);
+    }
+  }
+  if(packet_candidates_capacity < S->nb) {
+    packet_candidates_capacity = S->nb;
+    packet_candidates = realloc(
+      packet_candidates, sizeof(int) * packet_candidates_capacity
+    );
+  }
+  int nb = 0;
+  int i = 0;
+#ifdef __AVX2__
+  if(use_simd) {
+    __m256 Nx[4], Ny[4], Nz[4];
+    for(int k=0; k<4; ++k) {
+      Nx[k] = _mm256_set1_ps(N[k].x);
+      Ny[k] = _mm256_set1_ps(N[k].y);
+      Nz[k] = _mm256_set1_ps(N[k].z);
+    }
+    const __m256 ox = _mm256_set1_ps(orig.x);
+    const __m256 oy = _mm256_set1_ps(orig.y);
+    const __m256 oz = _mm256_set1_ps(orig.z);
+    const __m256 eps = _mm256_set1_ps(PACKET_CULL_EPS);
+    for(; i+SPHERES_LANES <= S->nb; i+=SPHERES_LANES) {
+      __m256 Lx = _mm256_sub_ps(_mm256_loadu_ps(S->cx+i), ox);
+      __m256 Ly = _mm256_sub_ps(_mm256_loadu_ps(S->cy+i), oy);
+      __m256 Lz = _mm256_sub_ps(_mm256_loadu_ps(S->cz+i), oz);
+      __m256 r = _mm256_sub_ps(
+	_mm256_setzero_ps(),
+	_mm256_add_ps(_mm256_sqrt_ps(_mm256_loadu_ps(S->r2+i)), eps)
+      );
+      __m256 in = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+      for(int k=0; k<4; ++k) {
+	__m256 d = _mm256_add_ps(
+	  _mm256_add_ps(_mm256_mul_ps(Lx,Nx[k]), _mm256_mul_ps(Ly,Ny[k])),
+	  _mm256_mul_ps(Lz,Nz[k])
+	);
+	in = _mm256_and_ps(in, _mm256_cmp_ps(d, r, _CMP_GE_OQ));
+      }
+      for(int mask = _mm256_movemask_ps(in); mask; mask &= mask-1) {
+	packet_candidates[nb++] = i + __builtin_ctz(mask);
+      }
+    }
+  }
+#endif
+  for(; i<S->nb; ++i) {
+    vec3 L = vec3_sub(Spheres_center(S,i), orig);
+    float r = Spheres_radius(S,i) + PACKET_CULL_EPS;
+    if(
+      vec3_dot(N[0],L) >= -r && vec3_dot(N[1],L) >= -r &&
+      vec3_dot(N[2],L) >= -r && vec3_dot(N[3],L) >= -r
+    ) {
+      packet_candidates[nb++] = i;
+    }
+  }
+  return nb;
+}
+
+/* nearest candidate sphere for each of the 4 rays */
+void packet_nearest_scalar(
+  Spheres* S, int nb, vec3 orig, vec3* dir, float* dist, int* index
+) {
+  for(int k=0; k<4; ++k) {
+    dist[k] = 1e30;
+    index[k] = -1;
+    for(int c=0; c<nb; ++c) {
+      float t;
+      int i = packet_candidates[c];
+      if(Spheres_ray_intersect(S, i, orig, dir[k], &t) && t < dist[k]) {
+	dist[k] = t;
+	index[k] = i;
+      }
+    }
+  }
+}
+
+#ifdef __AVX2__
+
+/*
+ * Same as packet_nearest_scalar(), lane k is ray k (same operations as
+ * Spheres_ray_intersect()).
+ */
+void packet_nearest(
+  Spheres* S, int nb, vec3 orig, vec3* dir, float* dist, int* index
+) {
+  if(!use_simd) {
+    packet_nearest_scalar(S, nb, orig, dir, dist, index);
+    return;
+  }
+  const __m128 dx = _mm_setr_ps(dir[0].x, dir[1].x, dir[2].x, dir[3].x);
+  const __m128 dy = _mm_setr_ps(dir[0].y, dir[1].y, dir[2].y, dir[3].y);
+  const __m128 dz = _mm_setr_ps(dir[0].z, dir[1].z, dir[2].z, dir[3].z);
+  const __m128 zero = _mm_setzero_ps();
+  __m128 best = _mm_set1_ps(1e30f);
+  __m128i best_index = _mm_set1_epi32(-1);
+  for(int c=0; c<nb; ++c) {
+    int i = packet_candidates[c];
+    vec3 L = vec3_sub(Spheres_center(S,i), orig);
+    __m128 Lx = _mm_set1_ps(L.x);
+    __m128 Ly = _mm_set1_ps(L.y);
+    __m128 Lz = _mm_set1_ps(L.z);
+    __m128 r2 = _mm_set1_ps(S->r2[i]);
+    __m128 tca = _mm_add_ps(
+      _mm_add_ps(_mm_mul_ps(Lx,dx), _mm_mul_ps(Ly,dy)), _mm_mul_ps(Lz,dz)
+    );
+    __m128 LL = _mm_set1_ps(vec3_dot(L,L));
+    __m128 d2 = _mm_sub_ps(LL, _mm_mul_ps(tca,tca));
+    __m128 hit = _mm_cmp_ps(d2, r2, _CMP_LE_OQ);
+    if(!_mm_movemask_ps(hit)) {
+      continue;
+    }
+    __m128 thc = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(r2, d2), zero));
+    __m128 t0 = _mm_sub_ps(tca, thc);
+    __m128 t1 = _mm_add_ps(tca, thc);
+    __m128 t = _mm_blendv_ps(t0, t1, _mm_cmp_ps(t0, zero, _CMP_LT_OQ));
+    hit = _mm_and_ps(hit, _mm_cmp_ps(t, zero, _CMP_GE_OQ));
+    hit = _mm_and_ps(hit, _mm_cmp_ps(t, best, _CMP_LT_OQ));
+    best = _mm_blendv_ps(best, t, hit);
+    best_index = _mm_castps_si128(_mm_blendv_ps(
+      _mm_castsi128_ps(best_index), _mm_castsi128_ps(_mm_set1_epi32(i)), hit
+    ));
+  }
+  _mm_storeu_ps(dist, best);
+  _mm_storeu_si128((__m128i*)index, best_index);
+}
+
+#else
+
+void packet_nearest(
+  Spheres* S, int nb, vec3 orig, vec3* dir, float* dist, int* index
+) {
+  packet_nearest_scalar(S, nb, orig, dir, dist, index);
+}
+
+#endif
+
+/*
+ * color of the 2x2 pixels (x,y), (x+1,y), (x,y+1), (x+1,y+1) of a
+ * width x height image
+ */
+void trace_packet(int x, int y, int width, int height, vec3* colors) {
+   if(
+     !use_packets ||
+     (use_grid && grid.spheres == &spheres && grid.nb_spheres == spheres.nb)
+   ) {
+     for(int k=0; k<4; ++k) {
+       colors[k] = trace_pixel(x+(k&1), y+(k>>1), width, height);
+     }
+     return;
+   }
+   vec3 orig = make_vec3(0,0,0);
+   vec3 dir[4];
+   for(int k=0; k<4; ++k) {
+     dir[k] = primary_dir(x+(k&1), y+(k>>1), width, height);
+   }
+   int nb = packet_cull(&spheres, orig, dir);
+   float dist[4];
+   int index[4];
+   packet_nearest(&spheres, nb, orig, dir, dist, index);
+#ifdef RT_BENCH
+   nb_rays += 4;
+#endif
+   for(int k=0; k<4; ++k) {
+     vec3 point, N;
+     Material material = make_Material_default();
+     if(
+       scene_intersect_after_spheres(
+	 orig, dir[k], &spheres, index[k] >= 0, dist[k], index[k],
+	 &point, &N, &material
+       )
+     ) {
+       colors[k] = shade(
+	 dir[k], point, N, material, &spheres, lights, nb_lights, 0
+       );
+     } else {
+       colors[k] = background(dir[k]);
+     }
+   }
+}
+
+void render_2x2(int x, int y, float* r, float* g, float* b) {
+   vec3 C[4];
+   trace_packet(x, y, GL_width, GL_height, C);
+   for(int k=0; k<4; ++k) {
+     r[k]=C[k].x;
+     g[k]=C[k].y;
+     b[k]=C[k].z;
+   }
+}
+
+/*
+ * Benchmark mode, compile with -DRT_BENCH: renders stress scenes with more
+ * and more spheres (without displaying them), and reports the number of
+ * rays per second (calls to scene_intersect(): primary, reflection,
+ * refraction and shadow rays) with the grid (built at all sizes, the
+ * display only uses it from GRID_MIN_SPHERES spheres), with brute force in SIMD
+ * (with -mavx2) and in scalar, and with brute force and packets of 2x2
+ * primary rays (trace_packet()). Then does the same
+ * with tori of more and more triangles (written to an OBJ file and loaded
+ * with Mesh_load()), with and without the BVH. The images must be the
+ * same.
+ */
+#ifdef RT_BENCH
+
+#include <time.h>
+
+#define BENCH_WIDTH  160
+#define BENCH_HEIGHT 100
+#define BENCH_BRUTE_MAX 1000 // brute force is too slow for larger scenes
 
-int main() {
+/* rays per second, rendering the image in pixels */
+double bench_render(vec3* pixels) {
+  nb_rays = 0;
+  clock_t start = clock();
+  for(int y=0; y<BENCH_HEIGHT; ++y) {
+    for(int x=0; x<BENCH_WIDTH; ++x) {
+      pixels[y*BENCH_WIDTH+x] = trace_pixel(x, y, BENCH_WIDTH, BENCH_HEIGHT);
+    }
+  }
+  clock_t t = clock() - start;
+  return (double)nb_rays * CLOCKS_PER_SEC / (double)(t + 1);
+}
+
+/* same as bench_render(), with packets of 2x2 primary rays */
+double bench_render_packets(vec3* pixels) {
+  nb_rays = 0;
+  clock_t start = clock();
+  for(int y=0; y<BENCH_HEIGHT; y+=2) {
+    for(int x=0; x<BENCH_WIDTH; x+=2) {
+      vec3 C[4];
+      trace_packet(x, y, BENCH_WIDTH, BENCH_HEIGHT, C);
+      for(int k=0; k<4; ++k) {
+	pixels[(y+(k>>1))*BENCH_WIDTH+x+(k&1)] = C[k];
+      }
+    }
+  }
+  clock_t t = clock() - start;
+  return (double)nb_rays * CLOCKS_PER_SEC / (double)(t + 1);
+}
+
+/* writes a torus with nu x nv quads to an OBJ file */
+BOOL write_torus(const char* filename, int nu, int nv) {
+  FILE* f = fopen(filename, "w");
+  if(f == NULL) {
+    return 0;
+  }
+  fprintf(f, "# torus %dx%d\n", nu, nv);
+  for(int u=0; u<nu; ++u) {
+    for(int v=0; v<nv; ++v) {
+      float a = 2.0f * M_PI * u / nu, b = 2.0f * M_PI * v / nv;
+      float r = 1.0f + 0.4f * cosf(b);
+      fprintf(f, "v %f %f %f\n", r * cosf(a), 0.4f * sinf(b), r * sinf(a));
+    }
+  }
+  for(int u=0; u<nu; ++u) {
+    for(int v=0; v<nv; ++v) {
+      int u1 = (u+1)%nu, v1 = (v+1)%nv;
+      fprintf(
+	f, "f %d/%d %d/%d %d/%d %d/%d\n",
+	u*nv+v+1, 1, u1*nv+v+1, 1, u1*nv+v1+1, 1, u*nv+v1+1, 1
+      );
+    }
+  }
+  fclose(f);
+  return 1;
+}
+
+/* number of different pixels */
+int nb_diffs(vec3* a, vec3* b) {
+  int result = 0;
+  for(int p=0; p<BENCH_WIDTH*BENCH_HEIGHT; ++p) {
+    result += (a[p].x != b[p].x || a[p].y != b[p].y || a[p].z != b[p].z);
+  }
+  return result;
+}
+
+int bench() {
+  static const int sizes[] = { 4, 100, 200, 1000, 10000, 100000 };
+  static const int torus[][2] = { {16,8}, {64,16}, {256,64}, {1024,256} };
+  vec3* ref = malloc(sizeof(vec3) * BENCH_WIDTH * BENCH_HEIGHT);
+  vec3* img = malloc(sizeof(vec3) * BENCH_WIDTH * BENCH_HEIGHT);
+  vec3* display = malloc(sizeof(vec3) * BENCH_WIDTH * BENCH_HEIGHT);
+  int nb_errors = 0;
+  for(int i=0; i<(int)(sizeof(sizes)/sizeof(sizes[0])); ++i) {
+    // as displayed: packets, and the grid from GRID_MIN_SPHERES spheres
+    grid_min_spheres = GRID_MIN_SPHERES;
     init_scene();
+    init_stress_scene(sizes[i]);
+    use_grid = 1;
+    double display_rate = bench_render_packets(display);
+    grid_min_spheres = 0; // the grid is measured at all sizes
+    Grid_build(&grid, &spheres);
+    double grid_rate = bench_render(img);
+    int diffs = nb_diffs(display, img);
+    if(sizes[i] > BENCH_BRUTE_MAX) {
+      nb_errors += diffs;
+      printf(
+	"%6d spheres  display: %8.3f Mrays/s  grid: %8.3f Mrays/s"
+	"  (%dx%dx%d cells)  %s\n", sizes[i], display_rate * 1e-6,
+	grid_rate * 1e-6, grid.res[0], grid.res[1], grid.res[2],
+	diffs ? "MISMATCH" : "ok"
+      );
+      continue;
+    }
+    use_grid = 0;
+    double brute_rate = bench_render(ref);
+    diffs += nb_diffs(ref, img);
+    use_simd = 0;
+    double scalar_rate = bench_render(img);
+    use_simd = 1;
+    diffs += nb_diffs(ref, img);
+    double packets_rate = bench_render_packets(img);
+    diffs += nb_diffs(ref, img);
+    nb_errors += diffs;
+    printf(
+      "%6d spheres  display: %8.3f Mrays/s  grid: %8.3f Mrays/s"
+      "  brute force: %8.3f Mrays/s  (scalar: %8.3f Mrays/s)"
+      "  packets: %8.3f Mrays/s  %s\n",
+      sizes[i], display_rate * 1e-6, grid_rate * 1e-6, brute_rate * 1e-6,
+      scalar_rate * 1e-6, packets_rate * 1e-6, diffs ? "MISMATCH" : "ok"
+    );
+  }
+  grid_min_spheres = GRID_MIN_SPHERES;
+  init_scene();
+  for(int i=0; i<(int)(sizeof(torus)/sizeof(torus[0])); ++i) {
+    const char* filename = "rt_bench_torus.obj";
+    if(
+      !write_torus(filename, torus[i][0], torus[i][1]) ||
+      !Mesh_load(&mesh, filename, make_vec3(4, -2.5, -12), 3)
+    ) {
+      printf("could not write or load %s\n", filename);
+      return 1;
+    }
+    remove(filename);
+    mesh.material = 0; // ivory
+    use_bvh = 1;
+    double bvh_rate = bench_render(img);
+    if(mesh.nb_triangles > BENCH_BRUTE_MAX * 4) {
+      printf(
+	"%6d triangles  BVH: %8.3f Mrays/s  (%d nodes, depth %d)\n",
+	mesh.nb_triangles, bvh_rate * 1e-6, mesh.nb_nodes, mesh.depth
+      );
+      continue;
+    }
+    use_bvh = 0;
+    double brute_rate = bench_render(ref);
+    int diffs = nb_diffs(ref, img);
+    nb_errors += diffs;
+    printf(
+      "%6d triangles  BVH: %8.3f Mrays/s  brute force: %8.3f Mrays/s"
+      "  x%.2f  %s\n",
+      mesh.nb_triangles, bvh_rate * 1e-6, brute_rate * 1e-6,
+      bvh_rate / brute_rate, diffs ? "MISMATCH" : "ok"
+    );
+  }
+  free(ref);
+  free(img);
+  free(display);
+  return nb_errors ? 1 : 0;
+}
+
+#endif
+
+int main(int argc, char** argv) {
+#ifdef RT_BENCH
+    return bench();
+#endif
+    init_scene();
+    if(argc > 1) {
+       // the mesh is put next to the glass sphere, on the checkerboard
+       if(!Mesh_load(&mesh, argv[1], make_vec3(4, -2.5, -12), 3)) {
+	  fprintf(stderr, "could not load %s\n", argv[1]);
+	  return 1;
+       }
+       mesh.material = 0; // ivory
+    }
     GL_init();
-    GL_scan_RGBf(GL_width, GL_height, render);
+    GL_scan_RGBf_2x2(GL_width, GL_height, render_2x2);
     GL_terminate();
     return 0;
 }